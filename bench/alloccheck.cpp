@@ -0,0 +1,480 @@
+// wayvibes-alloccheck: replays input events through the daemon loop and fails if the input or
+// audio thread allocates once warmed up. Needs the allocation tracking build of the sources
+// (`make alloccheck`, or the wayvibes-alloccheck CMake target).
+//
+//   wayvibes-alloccheck [--io-uring] [--events <count>]
+//   wayvibes-alloccheck [--io-uring] --soak <duration> [--interval <duration>]
+//
+// Events are written to pipes standing in for input devices, so reading (through io_uring with
+// --io-uring), dedup, dispatch, the trigger queue and the mixer run exactly as in the daemon.
+// Prints the allocation report and exits 1 when the hot path allocated.
+//
+// --soak (durations like 90s, 30m or 12h) instead types and mouses like a user for that long,
+// on the null audio backend, while reloading the soundpack and serving control requests now
+// and then. RSS, heap in use, open fds, voice occupancy and latency percentiles are sampled
+// every interval (default: 1/20 of the run); it also exits 1 when one of them drifted between
+// the first and the last quarter of the run.
+
+#include "alloctrack.h"
+#include "audio.h"
+#include "config.h"
+#include "control.h"
+#include "daemon.h"
+#include "soundpack.h"
+#include "stats.h"
+#include "testpack.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <linux/input.h>
+#include <malloc.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef WAYVIBES_ALLOC_TRACKING
+#error "build with -DWAYVIBES_ALLOC_TRACKING (make alloccheck does)"
+#endif
+
+#define WARMUP_EVENTS 512
+#define EVENTS_PER_WRITE 8
+#define WRITE_INTERVAL_US 1000
+
+#define SOAK_TICK_MS 10
+#define SOAK_RELOAD_S 30 // SIGHUP reload, retiring the previous soundpack
+
+// Drift limits, last quarter of the samples against the first
+#define DRIFT_RSS_BYTES (4 << 20)
+#define DRIFT_HEAP_BYTES (1 << 20)
+#define DRIFT_RATIO 0.10 // of the first quarter, when larger than the byte limits
+#define DRIFT_VOICES 2.0
+#define DRIFT_LATENCY_US 2000
+#define DRIFT_TIMING_RATIO 0.5 // voices and latency, when larger than the limits above
+
+static int keyboardPipe[2];
+static int mousePipe[2];
+
+static struct input_event inputEvent(unsigned short type, unsigned short code, int value) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  struct input_event ev = {};
+  ev.input_event_sec = now.tv_sec;
+  ev.input_event_usec = now.tv_nsec / 1000;
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+  return ev;
+}
+
+static bool writeBatch(int fd, const struct input_event *batch, int n) {
+  if (write(fd, batch, n * sizeof(batch[0])) != (ssize_t)(n * sizeof(batch[0]))) {
+    std::cerr << "Failed to write events" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Presses and releases over the pack's keys, with auto-repeats and SYN reports in between,
+// at about EVENTS_PER_WRITE events per millisecond
+static void writeEvents(unsigned long count) {
+  struct input_event batch[EVENTS_PER_WRITE];
+  unsigned long written = 0;
+  unsigned key = 0;
+  while (written < count) {
+    int n = 0;
+    while (n < EVENTS_PER_WRITE && written + n < count) {
+      unsigned short code = KEY_Q + key % (KEY_M - KEY_Q + 1);
+      int value = (written + n) % 4 == 3 ? 2 : (written + n) % 2 == 0 ? 1 : 0;
+      if ((written + n) % 16 == 15) {
+        batch[n] = inputEvent(EV_SYN, SYN_REPORT, 0);
+      } else {
+        batch[n] = inputEvent(EV_KEY, code, value);
+      }
+      if (value == 0) key += 7;
+      n++;
+    }
+    if (!writeBatch(keyboardPipe[1], batch, n)) return;
+    written += n;
+    std::this_thread::sleep_for(std::chrono::microseconds(WRITE_INTERVAL_US));
+  }
+}
+
+// Wait until the daemon loop has read `count` events in total
+static bool waitForEvents(unsigned long count) {
+  for (int i = 0; i < 5000; i++) {
+    if (stats.eventsRead.load() >= count) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+// Typing in bursts with pauses, keys held down until they auto-repeat, the long sound now
+// and then, mouse motion and clicks: about ten sounds a second on average
+struct Workload {
+  unsigned rng = 1;
+  int burstLeft = 0;  // presses left in the current burst
+  int pauseTicks = 0; // between bursts
+  int heldKey = -1;
+  int holdTicks = 0;
+  int moveTicks = 0;
+
+  unsigned next(unsigned n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng % n;
+  }
+};
+
+static bool writeWorkloadTick(Workload &w) {
+  struct input_event keys[4], mouse[6];
+  int nk = 0, nm = 0;
+
+  if (w.heldKey >= 0) {
+    if (--w.holdTicks <= 0) {
+      keys[nk++] = inputEvent(EV_KEY, w.heldKey, 0);
+      w.heldKey = -1;
+    } else if (w.holdTicks % 3 == 0) {
+      keys[nk++] = inputEvent(EV_KEY, w.heldKey, 2);
+    }
+  } else if (w.pauseTicks > 0) {
+    w.pauseTicks--;
+  } else if (w.burstLeft == 0) {
+    w.burstLeft = 5 + w.next(40);
+  } else if (w.next(6) == 0) {
+    unsigned short code = w.next(150) == 0 ? KEY_SPACE : KEY_Q + w.next(KEY_M - KEY_Q + 1);
+    keys[nk++] = inputEvent(EV_KEY, code, 1);
+    if (w.next(40) == 0) {
+      w.heldKey = code;
+      w.holdTicks = 30 + w.next(50);
+    } else {
+      keys[nk++] = inputEvent(EV_KEY, code, 0);
+    }
+    if (--w.burstLeft == 0) w.pauseTicks = 20 + w.next(200);
+  }
+
+  if (w.moveTicks > 0) {
+    w.moveTicks--;
+    mouse[nm++] = inputEvent(EV_REL, REL_X, (int)w.next(9) - 4);
+    mouse[nm++] = inputEvent(EV_REL, REL_Y, (int)w.next(9) - 4);
+  } else if (w.next(300) == 0) {
+    w.moveTicks = 10 + w.next(100);
+  }
+  if (w.next(150) == 0) {
+    unsigned short button = w.next(4) == 0 ? BTN_RIGHT : BTN_LEFT;
+    mouse[nm++] = inputEvent(EV_KEY, button, 1);
+    mouse[nm++] = inputEvent(EV_KEY, button, 0);
+  }
+
+  if (nk) keys[nk++] = inputEvent(EV_SYN, SYN_REPORT, 0);
+  if (nm) mouse[nm++] = inputEvent(EV_SYN, SYN_REPORT, 0);
+  return (!nk || writeBatch(keyboardPipe[1], keys, nk)) &&
+         (!nm || writeBatch(mousePipe[1], mouse, nm));
+}
+
+// One control request and its reply, as `wayvibes ctl` sends them
+static void controlRequest(const char *request) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  std::string path = controlSocketPath();
+  if (path.size() >= sizeof(addr.sun_path)) return;
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+      write(fd, request, strlen(request)) == (ssize_t)strlen(request)) {
+    char reply[4096];
+    while (read(fd, reply, sizeof(reply)) > 0) continue;
+  }
+  close(fd);
+}
+
+struct SoakSample {
+  double seconds;
+  long rssBytes;
+  long heapBytes;
+  int fds;
+  double voices; // mean active voices over the interval
+  unsigned latencyP50Us;
+  unsigned latencyP99Us;
+};
+
+static long residentBytes() {
+  long pages = 0, resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "re");
+  if (!statm) return 0;
+  if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+  fclose(statm);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static int openFds() {
+  int fds = 0;
+  for (const auto &entry : std::filesystem::directory_iterator("/proc/self/fd")) {
+    (void)entry;
+    fds++;
+  }
+  return fds - 1; // the iterator's own
+}
+
+// Percentile of the latencies recorded since `previous`, which is then brought up to date
+static unsigned intervalPercentileUs(std::vector<unsigned long> &previous, double percentile) {
+  unsigned long total = 0;
+  std::vector<unsigned long> delta(LATENCY_BUCKETS);
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    delta[i] = stats.latencyBuckets[i].load() - previous[i];
+    total += delta[i];
+  }
+  if (total == 0) return 0;
+  unsigned long rank = (unsigned long)(total * percentile / 100.0), seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += delta[i];
+    if (seen > rank) return (i + 1) * LATENCY_BUCKET_US;
+  }
+  return LATENCY_BUCKETS * LATENCY_BUCKET_US;
+}
+
+static void printSample(const SoakSample &s) {
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(1) << std::setw(8) << s.seconds << std::setw(10)
+       << s.rssBytes / 1048576.0 << std::setw(10) << s.heapBytes / 1048576.0 << std::setw(6)
+       << s.fds << std::setw(8) << s.voices << std::setw(8) << s.latencyP50Us << "/"
+       << s.latencyP99Us;
+  std::cout << line.str() << std::endl;
+}
+
+// Reload the soundpack, and wait until the daemon loop adopted it
+static bool reloadSoundpack() {
+  unsigned long reloads = stats.reloads.load();
+  kill(getpid(), SIGHUP);
+  for (int i = 0; i < 10000 && stats.reloads.load() == reloads; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return stats.reloads.load() != reloads;
+}
+
+static void runSoak(double durationS, double intervalS, std::vector<SoakSample> &samples) {
+  // the first reload grows the heap to its steady state, before the baseline is taken
+  if (!reloadSoundpack()) return;
+
+  std::cout << "    time   rss MiB  heap MiB   fds  voices  p50/p99 us" << std::endl;
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = [&]() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  Workload workload;
+  std::vector<unsigned long> latencyBuckets(LATENCY_BUCKETS);
+  for (int i = 0; i < LATENCY_BUCKETS; i++) latencyBuckets[i] = stats.latencyBuckets[i].load();
+  double nextSampleS = intervalS, nextReloadS = SOAK_RELOAD_S;
+  unsigned long reloads = stats.reloads.load();
+  double voiceSum = 0;
+  unsigned long ticks = 0;
+
+  while (elapsed() < durationS) {
+    if (!writeWorkloadTick(workload)) return;
+    voiceSum += stats.activeVoices.load();
+    ticks++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(SOAK_TICK_MS));
+
+    if (elapsed() >= nextReloadS && stats.reloads.load() == reloads) {
+      kill(getpid(), SIGHUP);
+      reloads++;
+      nextReloadS += SOAK_RELOAD_S;
+    }
+    // a reload in flight holds the decoded pack and its files open: sample once it's adopted
+    if (elapsed() >= nextSampleS && stats.reloads.load() == reloads) {
+      controlRequest("stats\n");
+      SoakSample sample;
+      sample.seconds = elapsed();
+      sample.rssBytes = residentBytes();
+      sample.heapBytes = (long)mallinfo2().uordblks;
+      sample.fds = openFds();
+      sample.voices = voiceSum / ticks;
+      sample.latencyP50Us = intervalPercentileUs(latencyBuckets, 50);
+      sample.latencyP99Us = intervalPercentileUs(latencyBuckets, 99);
+      for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        latencyBuckets[i] = stats.latencyBuckets[i].load();
+      }
+      printSample(sample);
+      samples.push_back(sample);
+      voiceSum = 0;
+      ticks = 0;
+      nextSampleS += intervalS;
+    }
+  }
+}
+
+// Mean of a field over the first and the last quarter of the samples
+template <typename Field>
+static void quarterMeans(const std::vector<SoakSample> &samples, Field field, double &first,
+                         double &last) {
+  size_t quarter = std::max<size_t>(1, samples.size() / 4);
+  first = last = 0;
+  for (size_t i = 0; i < quarter; i++) {
+    first += field(samples[i]);
+    last += field(samples[samples.size() - 1 - i]);
+  }
+  first /= quarter;
+  last /= quarter;
+}
+
+// Names the measurements that drifted past their limits, empty if none did
+static std::string findDrift(const std::vector<SoakSample> &samples) {
+  std::ostringstream drift;
+  drift << std::fixed << std::setprecision(1);
+  double first, last;
+
+  quarterMeans(samples, [](const SoakSample &s) { return (double)s.rssBytes; }, first, last);
+  if (last - first > std::max((double)DRIFT_RSS_BYTES, first * DRIFT_RATIO)) {
+    drift << " rss " << first / 1048576.0 << " -> " << last / 1048576.0 << " MiB;";
+  }
+  quarterMeans(samples, [](const SoakSample &s) { return (double)s.heapBytes; }, first, last);
+  if (last - first > std::max((double)DRIFT_HEAP_BYTES, first * DRIFT_RATIO)) {
+    drift << " heap " << first / 1048576.0 << " -> " << last / 1048576.0 << " MiB;";
+  }
+  quarterMeans(samples, [](const SoakSample &s) { return (double)s.fds; }, first, last);
+  if (last > first) drift << " fds " << first << " -> " << last << ";";
+  quarterMeans(samples, [](const SoakSample &s) { return s.voices; }, first, last);
+  if (last - first > std::max(DRIFT_VOICES, first * DRIFT_TIMING_RATIO)) {
+    drift << " voices " << first << " -> " << last << ";";
+  }
+  quarterMeans(samples, [](const SoakSample &s) { return (double)s.latencyP99Us; }, first,
+               last);
+  if (last - first > std::max((double)DRIFT_LATENCY_US, first * DRIFT_TIMING_RATIO)) {
+    drift << " p99 latency " << first << " -> " << last << " us;";
+  }
+  return drift.str();
+}
+
+// "90", "90s", "30m", "12h" in seconds, 0 if invalid
+static double parseDuration(const std::string &text) {
+  char *end;
+  double value = std::strtod(text.c_str(), &end);
+  std::string unit = end;
+  if (unit == "m") value *= 60;
+  else if (unit == "h") value *= 3600;
+  else if (!unit.empty() && unit != "s") return 0;
+  return value > 0 ? value : 0;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long events = 20000;
+  double soakS = 0, intervalS = 0;
+  bool usage = false;
+  for (int i = 1; i < argc && !usage; i++) {
+    std::string arg = argv[i];
+    if (arg == "--events" && i + 1 < argc) {
+      events = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--io-uring") {
+      setIoUringInput(true);
+    } else if (arg == "--soak" && i + 1 < argc) {
+      usage = (soakS = parseDuration(argv[++i])) == 0;
+    } else if (arg == "--interval" && i + 1 < argc) {
+      usage = (intervalS = parseDuration(argv[++i])) == 0;
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    std::cerr << "Usage: wayvibes-alloccheck [--io-uring] [--events <count>]\n"
+              << "       wayvibes-alloccheck [--io-uring] --soak <duration> "
+                 "[--interval <duration>]"
+              << std::endl;
+    return 2;
+  }
+  if (soakS && !intervalS) intervalS = std::clamp(soakS / 20, 1.0, 60.0);
+  if (soakS && soakS < intervalS * 4) {
+    std::cerr << "The soak needs at least 4 intervals to compare." << std::endl;
+    return 2;
+  }
+
+  // the loop publishes the same status page as a real daemon would
+  if (isDaemonRunning()) {
+    std::cerr << "Stop the running wayvibes first." << std::endl;
+    return 2;
+  }
+
+  std::string packDir = writeTestPack("wayvibes-alloccheck");
+  setenv("XDG_RUNTIME_DIR", packDir.c_str(), 1); // control socket out of the way
+
+  if (soakS) useNullAudioBackend(); // hours of clicks are nobody's business
+  if (initializeAudioEngine() != MA_SUCCESS) {
+    std::cerr << "Failed to initialize audio engine" << std::endl;
+    return 2;
+  }
+  SoundpackConfig config;
+  if (!loadSoundpackConfig(packDir + "/config.json", config)) return 2;
+  Soundpack *soundpack = new Soundpack;
+  loadSoundpack(*soundpack, config, packDir, device.playback.channels, device.sampleRate);
+
+  if (pipe2(keyboardPipe, O_CLOEXEC) != 0 || pipe2(mousePipe, O_CLOEXEC) != 0) return 2;
+  std::vector<std::string> devicePaths = {"/proc/self/fd/" + std::to_string(keyboardPipe[0])};
+  std::string mousePath = soakS ? "/proc/self/fd/" + std::to_string(mousePipe[0]) : "";
+
+  signal(SIGTERM, SIG_IGN); // the feeder's SIGTERM stops the loop, or nothing if it never ran
+  bool replayed = false;
+  std::vector<SoakSample> samples;
+  std::thread feeder([&]() {
+    writeEvents(WARMUP_EVENTS);
+    if (waitForEvents(WARMUP_EVENTS)) {
+      resetAllocationCounts();
+      if (soakS) {
+        runSoak(soakS, intervalS, samples);
+        replayed = samples.size() >= 4;
+      } else {
+        writeEvents(events);
+        replayed = waitForEvents(WARMUP_EVENTS + events);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(200)); // let the voices play out
+    }
+    kill(getpid(), SIGTERM);
+  });
+
+  runMainLoopMulti(packDir, devicePaths, mousePath, soundpack, 1.0f);
+  feeder.join();
+  for (int fd : {keyboardPipe[0], keyboardPipe[1], mousePipe[0], mousePipe[1]}) close(fd);
+
+  std::cout << "Replayed " << stats.eventsRead.load() - WARMUP_EVENTS << " events, "
+            << stats.triggers.load() << " triggers" << std::endl;
+  printAllocationReport(std::cout);
+
+  uninitializeAudioEngine();
+  std::filesystem::remove_all(packDir);
+
+  if (!replayed) {
+    std::cerr << "FAIL: the daemon loop did not read all events" << std::endl;
+    return 1;
+  }
+  unsigned long hotAllocations =
+      allocationCount(ALLOC_STAGE_INPUT) + allocationCount(ALLOC_STAGE_AUDIO);
+  if (hotAllocations) {
+    std::cerr << "FAIL: " << hotAllocations << " allocations on the input and audio threads"
+              << std::endl;
+    return 1;
+  }
+  std::cout << "PASS: no allocations on the input and audio threads" << std::endl;
+
+  if (soakS) {
+    std::string drift = findDrift(samples);
+    if (!drift.empty()) {
+      std::cerr << "FAIL: drift over " << samples.size() << " samples:" << drift << std::endl;
+      return 1;
+    }
+    std::cout << "PASS: no drift in memory, fds, voices or latency over " << samples.size()
+              << " samples" << std::endl;
+  }
+  return 0;
+}
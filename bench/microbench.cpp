@@ -0,0 +1,585 @@
+// wayvibes-microbench: isolated timings of the per-event hot paths (input wakeups, dispatch,
+// decode, resampling, mixing). Prints a table, or JSON with --json for comparing builds and hosts.
+//
+//   wayvibes-microbench [--json] [--filter <substring>] [--sound <file>]...
+//
+// --sound adds decode benchmarks for real files (MP3, FLAC, ...); a generated WAV and the MP3s
+// of the bundled akko_lavender_purples pack, and loading that whole pack, are always measured.
+// jitter/ rows measure when sounds start relative to their key events, with and without
+// --latency scheduling (see benchJitter).
+//
+// Also checks the fixed-point mixer against the float one and exits 1 if they disagree.
+
+#include "alloctrack.h"
+#include "audio.h"
+#include "config.h"
+#include "governor.h"
+#include "inputring.h"
+#include "soundpack.h"
+#include "stats.h"
+#include "testpack.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <linux/input.h>
+#include <linux/perf_event.h>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+
+#define PERIOD_FRAMES 256
+#define MIN_RUN_NS 50000000LL // per repetition, after calibration
+#define REPETITIONS 5
+#define MIX_TOLERANCE 4 // LSB the fixed-point mixer may differ from the float one by
+
+// Allocations are counted by the tracking build of the sources (src/alloctrack.h)
+#ifndef WAYVIBES_ALLOC_TRACKING
+#error "build with -DWAYVIBES_ALLOC_TRACKING (make microbench does)"
+#endif
+
+// CPU cycles of this thread in user space, where perf counters are available
+struct CycleCounter {
+  int fd = -1;
+
+  CycleCounter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~CycleCounter() {
+    if (fd >= 0) close(fd);
+  }
+
+  long long read() const {
+    long long value = 0;
+    if (fd < 0 || ::read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return value;
+  }
+};
+
+struct Result {
+  std::string name;
+  unsigned long iterations;
+  double nsPerOp;
+  double allocsPerOp;
+  double cyclesPerOp; // < 0 = unavailable
+};
+
+static std::vector<Result> results;
+static std::string filter;
+static CycleCounter cycles;
+
+static long long nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Time `op` over enough iterations for a stable figure; reports the median repetition
+static void bench(const std::string &name, const std::function<void()> &op) {
+  if (!filter.empty() && name.find(filter) == std::string::npos) return;
+
+  op(); // warm up caches and lazy allocations
+  unsigned long iterations = 1;
+  for (;;) {
+    long long start = nowNs();
+    for (unsigned long i = 0; i < iterations; i++) op();
+    if (nowNs() - start >= MIN_RUN_NS / 10 || iterations >= (1UL << 30)) break;
+    iterations *= 2;
+  }
+  iterations *= 10;
+
+  std::vector<Result> runs;
+  for (int r = 0; r < REPETITIONS; r++) {
+    unsigned long allocsBefore = allocationCount();
+    long long cyclesBefore = cycles.read();
+    long long start = nowNs();
+    for (unsigned long i = 0; i < iterations; i++) op();
+    long long elapsed = nowNs() - start;
+    long long cyclesAfter = cycles.read();
+    unsigned long allocs = allocationCount() - allocsBefore;
+
+    runs.push_back({name, iterations, (double)elapsed / iterations,
+                    (double)allocs / iterations,
+                    cyclesBefore >= 0 && cyclesAfter >= 0
+                        ? (double)(cyclesAfter - cyclesBefore) / iterations
+                        : -1.0});
+  }
+  std::sort(runs.begin(), runs.end(),
+            [](const Result &a, const Result &b) { return a.nsPerOp < b.nsPerOp; });
+  results.push_back(runs[REPETITIONS / 2]);
+}
+
+// A key press report (press, SYN) written to each of `devices` pipes, then collected the
+// daemon's two ways: poll() plus a read() per ready device, or one io_uring_enter() for the
+// multishot reads of all of them. The writes cost the same in both.
+static void benchInput() {
+  for (int devices : {1, 4, 8}) {
+    std::vector<int> readFds, writeFds;
+    for (int d = 0; d < devices; d++) {
+      int p[2];
+      if (pipe2(p, O_NONBLOCK | O_CLOEXEC) != 0) return;
+      readFds.push_back(p[0]);
+      writeFds.push_back(p[1]);
+    }
+    struct input_event report[2] = {};
+    report[0].type = EV_KEY;
+    report[0].code = KEY_Q;
+    report[0].value = 1;
+    auto writeReports = [&]() {
+      for (int fd : writeFds) {
+        if (write(fd, report, sizeof(report)) != sizeof(report)) abort();
+      }
+    };
+
+    std::vector<struct pollfd> pollFds;
+    for (int fd : readFds) pollFds.push_back({fd, POLLIN, 0});
+    bench("input/poll_read/devices_" + std::to_string(devices), [&]() {
+      writeReports();
+      struct input_event events[64];
+      poll(pollFds.data(), pollFds.size(), 0);
+      for (const struct pollfd &pfd : pollFds) {
+        if ((pfd.revents & POLLIN) && read(pfd.fd, events, sizeof(events)) <= 0) abort();
+      }
+    });
+
+    if (openInputRing(readFds, std::vector<bool>(readFds.size(), false), -1)) {
+      bench("input/io_uring/devices_" + std::to_string(devices), [&]() {
+        writeReports();
+        InputRingEntry entry;
+        for (int seen = 0; seen < devices;) {
+          waitInputRing(0);
+          while (takeInputRingEntry(entry)) seen++;
+        }
+      });
+      closeInputRing();
+    } else if (devices == 1) {
+      std::cerr << "io_uring multishot reads unavailable, skipping input/io_uring" << std::endl;
+    }
+
+    for (int fd : readFds) close(fd);
+    for (int fd : writeFds) close(fd);
+  }
+}
+
+static void benchDispatch(const std::string &packDir) {
+  SoundpackConfig config;
+  loadSoundpackConfig(packDir + "/config.json", config);
+  Soundpack pack;
+  loadSoundpack(pack, config, packDir, CHANNELS, SAMPLE_RATE);
+
+  unsigned keyCode = KEY_Q;
+  long long timeNs = 0;
+  bench("dispatch/pick_sample", [&]() {
+    const Sample *sample = pickSample(pack, keyCode, 1, timeNs += 1000000);
+    if (!sample) abort();
+    keyCode = keyCode == KEY_M ? KEY_Q : keyCode + 1;
+  });
+
+  // the original dispatch: a keycode -> file name map and a path built per press
+  std::unordered_map<int, std::string> keySoundMap;
+  for (const auto &[code, files] : config.keySounds) keySoundMap[code] = files[0];
+  keyCode = KEY_Q;
+  bench("legacy/map_lookup", [&]() {
+    auto it = keySoundMap.find((int)keyCode);
+    if (it == keySoundMap.end()) abort();
+    keyCode = keyCode == KEY_M ? KEY_Q : keyCode + 1;
+  });
+  bench("legacy/path_build", [&]() {
+    std::string path = packDir + "/" + keySoundMap[(int)keyCode];
+    if (path.empty()) abort();
+  });
+}
+
+static void benchDecode(const std::string &file) {
+  std::string extension = std::filesystem::path(file).extension().string();
+  std::string format = extension.empty() ? "unknown" : extension.substr(1);
+  std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+
+  ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0);
+  ma_uint64 frameCount;
+  void *frames;
+  if (ma_decode_file(file.c_str(), &config, &frameCount, &frames) != MA_SUCCESS) {
+    std::cerr << "Skipping " << file << ": not decodable" << std::endl;
+    return;
+  }
+  ma_free(frames, NULL);
+
+  bench("decode/" + format + "/" + std::filesystem::path(file).filename().string(), [&]() {
+    ma_uint64 frameCount;
+    void *frames;
+    if (ma_decode_file(file.c_str(), &config, &frameCount, &frames) == MA_SUCCESS) {
+      ma_free(frames, NULL);
+    }
+  });
+}
+
+// Loading a whole soundpack as the daemon does: decode every file, resample, convert
+static void benchLoad(const std::string &packDir) {
+  SoundpackConfig config;
+  if (!loadSoundpackConfig(packDir + "/config.json", config)) return;
+  bench("load/" + std::filesystem::path(packDir).filename().string(), [&]() {
+    Soundpack pack;
+    loadSoundpack(pack, config, packDir, CHANNELS, SAMPLE_RATE);
+  });
+}
+
+static void benchResample() {
+  std::vector<float> second = clickFrames(44100, 7);
+  bench("resample/44100_to_48000_1s", [&]() {
+    std::vector<float> out = resampleFrames(second.data(), 44100, CHANNELS, 48000.0 / 44100);
+    if (out.empty()) abort();
+  });
+  std::vector<float> click = clickFrames(SAMPLE_RATE / 10, 7);
+  bench("resample/pitch_variant_100ms", [&]() {
+    std::vector<float> out =
+        resampleFrames(click.data(), SAMPLE_RATE / 10, CHANNELS, 1.0 / 1.03);
+    if (out.empty()) abort();
+  });
+}
+
+// Render until no voice plays, so the next run starts clean and no voice outlives its pack
+static void drainVoices(std::vector<float> &out) {
+  for (int i = 0; i < 4000 && stats.activeVoices.load() > 0; i++) {
+    std::fill(out.begin(), out.end(), 0.0f);
+    renderAudio(out.data(), PERIOD_FRAMES, CHANNELS, SAMPLE_RATE);
+  }
+}
+
+// Synthesized soundpack: the built-in sound on every key, and a 10s one on space
+static std::string writeSynthTestPack(const std::string &program) {
+  std::string dir = (std::filesystem::temp_directory_path() /
+                     (program + "-synth-" + std::to_string(getpid())))
+                        .string();
+  std::filesystem::create_directories(dir);
+
+  nlohmann::json config;
+  config["type"] = "synth";
+  config["synth"]["default"] = nlohmann::json::object();
+  // rings for its whole length, so every voice renders all its modes
+  config["synth"]["long"] = {
+      {"length_ms", 10000},
+      {"modes", {{1.0, 1.0, 20000}, {2.32, 0.6, 20000}, {4.25, 0.35, 20000}, {6.63, 0.2, 20000}}}};
+  config["defines"][std::to_string(KEY_SPACE)] = "long";
+  std::ofstream(dir + "/config.json") << config.dump();
+  return dir;
+}
+
+// One PERIOD_FRAMES period with `voices` voices of the 10s sound playing; `integer` mixes
+// with the fixed-point mixer into int16, as for an s16 device
+static void benchMix(const std::string &packDir, SampleFormat format, const char *formatName,
+                     bool integer = false) {
+  setSampleFormat(format);
+  setIntegerMixing(integer);
+  SoundpackConfig config;
+  loadSoundpackConfig(packDir + "/config.json", config);
+  Soundpack pack;
+  loadSoundpack(pack, config, packDir, CHANNELS, SAMPLE_RATE);
+  setSoundpackGeneration(pack.generation);
+  setVolume(1.0f);
+  setScheduledLatency(0.0f);
+
+  const Sample *sample = pack.samples[pack.variants[pack.keys[KEY_SPACE].first]].get();
+  std::vector<float> out(PERIOD_FRAMES * CHANNELS);
+  std::vector<int16_t> out16(PERIOD_FRAMES * CHANNELS);
+
+  // the voice pool holds 64; more voices would only measure stealing
+  for (unsigned voices : {1u, 8u, 32u, 64u}) {
+    drainVoices(out);
+    bench("mix/" + std::string(formatName) + "/voices_" + std::to_string(voices), [&]() {
+      // keep `voices` voices alive, each in its own group so none choke another
+      for (unsigned v = stats.activeVoices.load(); v < voices; v++) {
+        playSample(sample, Retrigger{(unsigned short)v, RETRIGGER_STACK, 0, 0},
+                   pack.generation, 0);
+      }
+      if (integer) {
+        renderAudioS16(out16.data(), PERIOD_FRAMES, CHANNELS, SAMPLE_RATE);
+      } else {
+        std::fill(out.begin(), out.end(), 0.0f);
+        renderAudio(out.data(), PERIOD_FRAMES, CHANNELS, SAMPLE_RATE);
+      }
+    });
+  }
+  drainVoices(out);
+  setIntegerMixing(false);
+  setSampleFormat(SAMPLE_F32);
+}
+
+// Mix the same presses with both mixers, into int16, and compare: stacked and choked voices
+// (fades), at a volume that keeps the limiter busy. Returns false past MIX_TOLERANCE.
+static bool checkIntegerMix(const std::string &packDir) {
+  setSampleFormat(SAMPLE_S16);
+  SoundpackConfig config;
+  loadSoundpackConfig(packDir + "/config.json", config);
+  Soundpack pack;
+  loadSoundpack(pack, config, packDir, CHANNELS, SAMPLE_RATE);
+  setSoundpackGeneration(pack.generation);
+  setScheduledLatency(0.0f);
+
+  const unsigned periods = 400;
+  std::vector<float> scratch(PERIOD_FRAMES * CHANNELS);
+  std::vector<int16_t> mixed[2];
+  for (int integer = 0; integer < 2; integer++) {
+    setIntegerMixing(integer);
+    setVolume(1.0f);
+    drainVoices(scratch);
+    // silence until the limiter has fully recovered from the previous run
+    for (int i = 0; i < 100; i++) {
+      std::fill(scratch.begin(), scratch.end(), 0.0f);
+      renderAudio(scratch.data(), PERIOD_FRAMES, CHANNELS, SAMPLE_RATE);
+    }
+    setVolume(2.5f);
+
+    mixed[integer].resize(periods * PERIOD_FRAMES * CHANNELS);
+    for (unsigned p = 0; p < periods; p++) {
+      int key = KEY_Q + (int)(p * 7 % 10);
+      const Sample *sample = pack.samples[pack.variants[pack.keys[key].first]].get();
+      RetriggerMode mode = p % 2 ? RETRIGGER_CHOKE : RETRIGGER_STACK;
+      playSample(sample, Retrigger{(unsigned short)(p % 3), mode, 4, 200}, pack.generation, 0);
+      renderAudioS16(mixed[integer].data() + p * PERIOD_FRAMES * CHANNELS, PERIOD_FRAMES,
+                     CHANNELS, SAMPLE_RATE);
+    }
+  }
+  drainVoices(scratch);
+  setIntegerMixing(false);
+  setVolume(1.0f);
+  setSampleFormat(SAMPLE_F32);
+
+  int worst = 0;
+  for (size_t s = 0; s < mixed[0].size(); s++) {
+    worst = std::max(worst, std::abs(mixed[0][s] - mixed[1][s]));
+  }
+  std::cerr << "Fixed-point mix: within " << worst << " LSB of the float mix (tolerance "
+            << MIX_TOLERANCE << ")" << std::endl;
+  return worst <= MIX_TOLERANCE;
+}
+
+// Press the 10s sound on its own key every period with playback capped at `maxVoices`, as
+// --shed-voices and the load governor do: once the cap is reached every press must steal a
+// playing voice, never start one more. Returns false if more voices play than allowed.
+static bool checkVoiceCap(const std::string &packDir, unsigned maxVoices) {
+  SoundpackConfig config;
+  loadSoundpackConfig(packDir + "/config.json", config);
+  Soundpack pack;
+  loadSoundpack(pack, config, packDir, CHANNELS, SAMPLE_RATE);
+  setSoundpackGeneration(pack.generation);
+  setScheduledLatency(0.0f);
+
+  std::vector<float> out(PERIOD_FRAMES * CHANNELS);
+  drainVoices(out);
+  setPlaybackLimits(maxVoices, 0);
+  const Sample *sample = pack.samples[pack.variants[pack.keys[KEY_SPACE].first]].get();
+  unsigned long stealsBefore = stats.voiceSteals.load();
+  unsigned long mostVoices = 0;
+  const unsigned presses = maxVoices * 4;
+  for (unsigned p = 0; p < presses; p++) {
+    playSample(sample, Retrigger{(unsigned short)p, RETRIGGER_STACK, 0, 0}, pack.generation, 0);
+    std::fill(out.begin(), out.end(), 0.0f);
+    renderAudio(out.data(), PERIOD_FRAMES, CHANNELS, SAMPLE_RATE);
+    mostVoices = std::max(mostVoices, stats.activeVoices.load());
+  }
+  unsigned long steals = stats.voiceSteals.load() - stealsBefore;
+  setPlaybackLimits(0, 0);
+  drainVoices(out);
+
+  std::cerr << "Voice cap " << maxVoices << ": at most " << mostVoices << " voices, " << steals
+            << " steals for " << presses << " presses" << std::endl;
+  return mostVoices <= maxVoices && steals == presses - maxVoices;
+}
+
+// Start offset of a sound: when its first frame plays (callback time + its offset in the
+// period) minus the key event's time. Presses land at random points of a period and are
+// rendered in real time, one PERIOD_FRAMES callback per period. Starting voices at the next
+// callback makes the offset vary by up to a period; scheduling them at event time plus a
+// fixed latency should keep it constant. Reported as the standard deviation of the offset,
+// in the ns/op column.
+static void benchJitter() {
+  const long long periodNs = PERIOD_FRAMES * 1000000000LL / SAMPLE_RATE;
+  const int presses = 100;
+
+  // an impulse, so the first non-zero output frame is where the voice starts
+  Sample click;
+  click.format = SAMPLE_F32;
+  click.channels = 1;
+  click.frameCount = 64;
+  click.data.assign(click.frameCount * sizeof(float), 0);
+  ((float *)click.data.data())[0] = 0.5f;
+
+  std::vector<float> out(PERIOD_FRAMES * CHANNELS);
+  auto sleepUntil = [](long long timeNs) {
+    struct timespec ts = {(time_t)(timeNs / 1000000000LL), (long)(timeNs % 1000000000LL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+  };
+  auto monotonic = []() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  };
+
+  setVolume(1.0f);
+  for (long long latencyNs : {0LL, 4 * periodNs}) {
+    std::string name = latencyNs ? "jitter/scheduled_" + std::to_string(latencyNs / 1000) + "us"
+                                 : std::string("jitter/immediate");
+    name += "/start_offset_stddev";
+    if (!filter.empty() && name.find(filter) == std::string::npos) continue;
+    setScheduledLatency(latencyNs / 1e6f);
+    drainVoices(out);
+    unsigned rng = 12345;
+    std::vector<double> offsets;
+    long long callbackNs = monotonic();
+    for (int p = 0; p < presses; p++) {
+      rng ^= rng << 13;
+      rng ^= rng >> 17;
+      rng ^= rng << 5;
+      sleepUntil(callbackNs + periodNs * (rng % 1000) / 1000);
+      long long eventNs = monotonic();
+      playSample(&click, Retrigger{0, RETRIGGER_STACK, 0, 0}, 0, eventNs);
+
+      // callbacks on the period grid until the click has played
+      for (int period = 0; period < 16; period++) {
+        callbackNs += periodNs;
+        sleepUntil(callbackNs);
+        std::fill(out.begin(), out.end(), 0.0f);
+        long long renderNs = monotonic();
+        renderAudio(out.data(), PERIOD_FRAMES, CHANNELS, SAMPLE_RATE);
+        auto first = std::find_if(out.begin(), out.end(), [](float v) { return v != 0.0f; });
+        if (first == out.end()) continue;
+        long long frame = (first - out.begin()) / CHANNELS;
+        offsets.push_back((double)(renderNs + frame * 1000000000LL / SAMPLE_RATE - eventNs));
+        break;
+      }
+      drainVoices(out);
+      callbackNs = monotonic();
+    }
+
+    double mean = 0.0, variance = 0.0;
+    for (double offset : offsets) mean += offset / offsets.size();
+    for (double offset : offsets) variance += (offset - mean) * (offset - mean) / offsets.size();
+    results.push_back({name, offsets.size(), std::sqrt(variance), 0.0, -1.0});
+  }
+  setScheduledLatency(0.0f);
+}
+
+static std::string cpuModel() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) return line.substr(line.find(':') + 2);
+  }
+  return "unknown";
+}
+
+int main(int argc, char *argv[]) {
+  bool jsonOutput = false;
+  std::vector<std::string> sounds;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--json") {
+      jsonOutput = true;
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--sound" && i + 1 < argc) {
+      sounds.push_back(argv[++i]);
+    } else {
+      std::cerr << "Usage: wayvibes-microbench [--json] [--filter <substring>] "
+                   "[--sound <file>]..."
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::string packDir = writeTestPack("wayvibes-microbench");
+  sounds.insert(sounds.begin(), packDir + "/long.wav");
+  // the pack shipped with the sources, for the MP3 decoder most packs go through
+  std::string bundledPack =
+      (std::filesystem::path(__FILE__).parent_path().parent_path() / "akko_lavender_purples")
+          .string();
+  bool haveBundledPack = std::filesystem::exists(bundledPack + "/config.json");
+  if (haveBundledPack) {
+    sounds.insert(sounds.begin() + 1, {bundledPack + "/A.mp3", bundledPack + "/SPACE.mp3"});
+  } else {
+    std::cerr << "Bundled soundpack not found at " << bundledPack << ", skipping its MP3s"
+              << std::endl;
+  }
+
+  benchInput();
+  benchDispatch(packDir);
+  for (const std::string &sound : sounds) benchDecode(sound);
+  if (haveBundledPack) benchLoad(bundledPack);
+  benchResample();
+  benchJitter();
+  benchMix(packDir, SAMPLE_F32, "f32");
+  benchMix(packDir, SAMPLE_S16, "s16");
+  benchMix(packDir, SAMPLE_ULAW, "ulaw");
+  benchMix(packDir, SAMPLE_S16, "s16_fixed", true);
+  benchMix(packDir, SAMPLE_ULAW, "ulaw_fixed", true);
+  bool mixersAgree = checkIntegerMix(packDir);
+  // --shed-voices' smallest cap, then the load governor's levels
+  bool voicesCapped = checkVoiceCap(packDir, 8);
+  for (int level = 0; level < GOVERNOR_LEVELS; level++) {
+    if (unsigned maxVoices = governorLevelVoices(level)) {
+      std::cerr << "Governor level " << level << " (" << governorLevelName(level) << "): ";
+      voicesCapped = checkVoiceCap(packDir, maxVoices) && voicesCapped;
+    }
+  }
+  std::string synthDir = writeSynthTestPack("wayvibes-microbench");
+  benchMix(synthDir, SAMPLE_F32, "synth");
+
+  std::filesystem::remove_all(packDir);
+  std::filesystem::remove_all(synthDir);
+
+  if (jsonOutput) {
+    json report;
+    report["cpu"] = cpuModel();
+    report["compiler"] = __VERSION__;
+    report["sample_rate"] = SAMPLE_RATE;
+    report["channels"] = CHANNELS;
+    report["period_frames"] = PERIOD_FRAMES;
+    for (const Result &result : results) {
+      json entry = {{"name", result.name},
+                    {"iterations", result.iterations},
+                    {"ns_per_op", result.nsPerOp},
+                    {"allocs_per_op", result.allocsPerOp}};
+      entry["cycles_per_op"] = result.cyclesPerOp >= 0 ? json(result.cyclesPerOp) : json();
+      report["benchmarks"].push_back(entry);
+    }
+    std::cout << report.dump(2) << std::endl;
+    return mixersAgree && voicesCapped ? 0 : 1;
+  }
+
+  printf("%-44s %14s %12s %14s\n", "benchmark", "ns/op", "allocs/op", "cycles/op");
+  for (const Result &result : results) {
+    printf("%-44s %14.1f %12.2f ", result.name.c_str(), result.nsPerOp, result.allocsPerOp);
+    if (result.cyclesPerOp >= 0) {
+      printf("%14.0f\n", result.cyclesPerOp);
+    } else {
+      printf("%14s\n", "n/a");
+    }
+  }
+  return mixersAgree && voicesCapped ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#ifndef TESTPACK_H
+#define TESTPACK_H
+
+// Generated soundpack shared by the benchmark programs
+
+#include "miniaudio.h"
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <linux/input.h>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+
+// A click-like test sound: decaying noise burst with a tonal body
+static std::vector<float> clickFrames(ma_uint64 frames, unsigned seed) {
+  std::vector<float> pcm(frames * CHANNELS);
+  unsigned x = seed;
+  for (ma_uint64 f = 0; f < frames; f++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    float noise = (float)(x & 0xFFFF) / 32768.0f - 1.0f;
+    float envelope = std::exp(-(float)f / (SAMPLE_RATE * 0.02f));
+    float tone = std::sin(2.0f * (float)M_PI * 2200.0f * f / SAMPLE_RATE);
+    for (int c = 0; c < CHANNELS; c++) pcm[f * CHANNELS + c] = 0.4f * envelope * (noise + tone);
+  }
+  return pcm;
+}
+
+static bool writeWav(const std::string &path, const std::vector<float> &pcm,
+                     ma_uint32 sampleRate) {
+  ma_encoder_config config =
+      ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, CHANNELS, sampleRate);
+  ma_encoder encoder;
+  if (ma_encoder_init_file(path.c_str(), &config, &encoder) != MA_SUCCESS) return false;
+  ma_uint64 written = 0;
+  ma_encoder_write_pcm_frames(&encoder, pcm.data(), pcm.size() / CHANNELS, &written);
+  ma_encoder_uninit(&encoder);
+  return true;
+}
+
+// Soundpack with a distinct 100ms sound on keycodes KEY_Q..KEY_M and on the left and right
+// mouse buttons, plus a 10s sound on space, in a temporary directory named after `program`
+static std::string writeTestPack(const std::string &program) {
+  std::string dir = (std::filesystem::temp_directory_path() /
+                     (program + "-" + std::to_string(getpid())))
+                        .string();
+  std::filesystem::create_directories(dir);
+
+  nlohmann::json config;
+  for (int keyCode = KEY_Q; keyCode <= KEY_M; keyCode++) {
+    std::string file = "key" + std::to_string(keyCode) + ".wav";
+    writeWav(dir + "/" + file, clickFrames(SAMPLE_RATE / 10, keyCode), SAMPLE_RATE);
+    config["defines"][std::to_string(keyCode)] = file;
+  }
+  for (int button : {BTN_LEFT, BTN_RIGHT}) {
+    std::string file = "button" + std::to_string(button) + ".wav";
+    writeWav(dir + "/" + file, clickFrames(SAMPLE_RATE / 10, button), SAMPLE_RATE);
+    config["defines"][std::to_string(button)] = file;
+  }
+  writeWav(dir + "/long.wav", clickFrames(SAMPLE_RATE * 10, 1), SAMPLE_RATE);
+  config["defines"][std::to_string(KEY_SPACE)] = "long.wav";
+  config["normalize"] = false;
+  std::ofstream(dir + "/config.json") << config.dump();
+  return dir;
+}
+
+#endif // TESTPACK_H
@@ -32,23 +32,23 @@ install_dependencies() {
 
   if command -v apt &>/dev/null; then
     echo -e "${CYAN}📦 Detected Debian/Ubuntu-based system${RESET}"
-    DISTRO_PACKAGES="libevdev-dev nlohmann-json3-dev"
+    DISTRO_PACKAGES="nlohmann-json3-dev"
     INSTALL_CMD_PREFIX="sudo apt update && sudo apt install -y"
   elif command -v pacman &>/dev/null; then
     echo -e "${CYAN}📦 Detected Arch-based system${RESET}"
-    DISTRO_PACKAGES="libevdev nlohmann-json"
+    DISTRO_PACKAGES="nlohmann-json"
     INSTALL_CMD_PREFIX="sudo pacman -S --needed --noconfirm"
   elif command -v dnf &>/dev/null; then
     echo -e "${CYAN}📦 Detected Fedora-based system${RESET}"
-    DISTRO_PACKAGES="libevdev-devel nlohmann-json-devel"
+    DISTRO_PACKAGES="nlohmann-json-devel"
     INSTALL_CMD_PREFIX="sudo dnf install -y"
   else
     echo -e "${YELLOW}⚠️ Could not detect a supported package manager (apt, pacman, dnf).${RESET}"
     echo -e "${YELLOW}Please ensure the following dependencies for your distribution:${RESET}"
-    echo -e "${CYAN}  - Debian/Ubuntu: libevdev-dev nlohmann-json3-dev${RESET}"
-    echo -e "${CYAN}  - Arch: libevdev nlohmann-json${RESET}"
-    echo -e "${CYAN}  - Fedora: libevdev-devel nlohmann-json-devel${RESET}"
-    echo -e "${CYAN}  - RPM: libevdev-devel nlohmann_json-devel${RESET}"
+    echo -e "${CYAN}  - Debian/Ubuntu: nlohmann-json3-dev${RESET}"
+    echo -e "${CYAN}  - Arch: nlohmann-json${RESET}"
+    echo -e "${CYAN}  - Fedora: nlohmann-json-devel${RESET}"
+    echo -e "${CYAN}  - RPM: nlohmann_json-devel${RESET}"
     echo -ne "${CYAN}Ensured? (y/n): ${RESET}"
     read -r ENSURED
     if ! [[ "$ENSURED" =~ ^[Yy]$ ]]; then
@@ -0,0 +1,277 @@
+#include "alloctrack.h"
+
+#ifdef WAYVIBES_ALLOC_TRACKING
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#define MAX_THREADS 32 // the last slot collects exited threads and any beyond the others
+#define MAX_SITES 64
+#define SITE_DEPTH 10
+#define SKIPPED_FRAMES 2 // countAllocation, malloc / operator new
+
+// glibc exports its allocator under __libc_* names, so malloc itself can be interposed and
+// call stacks taken. Elsewhere only operator new is counted, without call stacks.
+#ifdef __GLIBC__
+#include <execinfo.h>
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+#define REAL_MALLOC __libc_malloc
+#else
+#define REAL_MALLOC std::malloc
+#endif
+
+static const char *stageNames[ALLOC_STAGE_COUNT] = {"other", "input", "audio"};
+
+// Constant-initialized: allocations come in before any dynamic initializer of this file runs
+struct ThreadCounts {
+  std::atomic<pid_t> tid{0};
+  std::atomic<unsigned long> counts[ALLOC_STAGE_COUNT]{};
+};
+
+struct Site {
+  AllocStage stage;
+  int depth;
+  void *frames[SITE_DEPTH];
+  unsigned long count;
+};
+
+static std::atomic<unsigned long> stageCounts[ALLOC_STAGE_COUNT];
+static ThreadCounts threads[MAX_THREADS];
+
+// Hot path allocations are rare (ideally absent), a spinlock is enough
+static Site sites[MAX_SITES];
+static int siteCount = 0;
+static unsigned long sitesDropped = 0;
+static std::atomic_flag sitesLock = ATOMIC_FLAG_INIT;
+
+// Plain thread_locals of the executable: static TLS, reading them never allocates
+static thread_local AllocStage currentStage = ALLOC_STAGE_OTHER;
+static thread_local ThreadCounts *threadSlot = nullptr;
+static thread_local bool threadExiting = false;
+static thread_local bool recording = false; // backtrace() may allocate on its first call
+
+AllocStageScope::AllocStageScope(AllocStage stage) : previous(currentStage) {
+  currentStage = stage;
+}
+
+AllocStageScope::~AllocStageScope() { currentStage = previous; }
+
+static ThreadCounts &sharedSlot() {
+  threads[MAX_THREADS - 1].tid.store(-1);
+  return threads[MAX_THREADS - 1];
+}
+
+// Hands the slot back when its thread exits, its counts moving to the shared slot, so
+// threads that come and go (reloads, reopened audio devices) don't use up the table
+struct ThreadSlotRelease {
+  ~ThreadSlotRelease() {
+    threadExiting = true; // later destructors' allocations go to the shared slot
+    ThreadCounts *slot = threadSlot;
+    threadSlot = nullptr;
+    if (!slot || slot == &threads[MAX_THREADS - 1]) return;
+    for (int stage = 0; stage < ALLOC_STAGE_COUNT; stage++) {
+      sharedSlot().counts[stage].fetch_add(slot->counts[stage].exchange(0));
+    }
+    slot->tid.store(0);
+  }
+};
+
+static ThreadCounts *claimThreadSlot() {
+  if (threadExiting) return &sharedSlot();
+  pid_t tid = (pid_t)syscall(SYS_gettid);
+  for (int i = 0; i < MAX_THREADS - 1; i++) {
+    pid_t expected = 0;
+    if (threads[i].tid.compare_exchange_strong(expected, tid)) {
+      threadSlot = &threads[i];
+      // registering the destructor may allocate; that finds threadSlot already set
+      static thread_local ThreadSlotRelease release;
+      (void)release;
+      return &threads[i];
+    }
+  }
+  return &sharedSlot();
+}
+
+static void lockSites() {
+  while (sitesLock.test_and_set(std::memory_order_acquire)) {
+  }
+}
+
+static void unlockSites() { sitesLock.clear(std::memory_order_release); }
+
+#ifdef __GLIBC__
+static void recordSite(AllocStage stage, void *const *frames, int depth) {
+  lockSites();
+  int i = 0;
+  for (; i < siteCount; i++) {
+    if (sites[i].stage == stage && sites[i].depth == depth &&
+        memcmp(sites[i].frames, frames, depth * sizeof(void *)) == 0) {
+      break;
+    }
+  }
+  if (i < siteCount) {
+    sites[i].count++;
+  } else if (siteCount < MAX_SITES) {
+    Site &site = sites[siteCount++];
+    site.stage = stage;
+    site.depth = depth;
+    memcpy(site.frames, frames, depth * sizeof(void *));
+    site.count = 1;
+  } else {
+    sitesDropped++;
+  }
+  unlockSites();
+}
+#endif
+
+// Not inlined, and the backtrace is taken here, so the frames to skip are always the same
+__attribute__((noinline)) static void countAllocation() {
+  AllocStage stage = currentStage;
+  stageCounts[stage].fetch_add(1, std::memory_order_relaxed);
+  if (!threadSlot) threadSlot = claimThreadSlot();
+  threadSlot->counts[stage].fetch_add(1, std::memory_order_relaxed);
+  if (stage == ALLOC_STAGE_OTHER || recording) return;
+
+#ifdef __GLIBC__
+  recording = true;
+  void *frames[SITE_DEPTH + SKIPPED_FRAMES];
+  int depth = backtrace(frames, SITE_DEPTH + SKIPPED_FRAMES) - SKIPPED_FRAMES;
+  recordSite(stage, frames + SKIPPED_FRAMES, depth > 0 ? depth : 0);
+  recording = false;
+#endif
+}
+
+#ifdef __GLIBC__
+extern "C" void *malloc(size_t size) {
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  countAllocation();
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  countAllocation();
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  countAllocation();
+  void *p = __libc_memalign(alignment, size);
+  if (!p) return ENOMEM;
+  *ptr = p;
+  return 0;
+}
+#endif // __GLIBC__
+
+// new[] and the nothrow forms go through this one; the default operator delete frees
+void *operator new(size_t size) {
+  countAllocation();
+  void *ptr = REAL_MALLOC(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+#ifdef __GLIBC__
+// backtrace() loads its unwinder on first use; do that before anything is measured
+static struct BacktraceWarmup {
+  BacktraceWarmup() {
+    void *frame;
+    recording = true;
+    backtrace(&frame, 1);
+    recording = false;
+  }
+} backtraceWarmup;
+#endif
+
+void resetAllocationCounts() {
+  for (auto &count : stageCounts) count.store(0, std::memory_order_relaxed);
+  for (ThreadCounts &thread : threads) {
+    for (auto &count : thread.counts) count.store(0, std::memory_order_relaxed);
+  }
+  lockSites();
+  siteCount = 0;
+  sitesDropped = 0;
+  unlockSites();
+}
+
+unsigned long allocationCount(AllocStage stage) {
+  return stageCounts[stage].load(std::memory_order_relaxed);
+}
+
+unsigned long allocationCount() {
+  unsigned long total = 0;
+  for (int stage = 0; stage < ALLOC_STAGE_COUNT; stage++) {
+    total += allocationCount((AllocStage)stage);
+  }
+  return total;
+}
+
+static void printStageCounts(std::ostream &out, const std::atomic<unsigned long> *counts) {
+  for (int stage = 0; stage < ALLOC_STAGE_COUNT; stage++) {
+    out << (stage ? ", " : "") << stageNames[stage] << " "
+        << counts[stage].load(std::memory_order_relaxed);
+  }
+  out << "\n";
+}
+
+static std::string threadName(pid_t tid) {
+  std::string name;
+  if (tid > 0) {
+    std::ifstream comm("/proc/self/task/" + std::to_string(tid) + "/comm");
+    std::getline(comm, name);
+  }
+  return name.empty() ? (tid > 0 ? "exited" : "exited and other threads") : name;
+}
+
+void printAllocationReport(std::ostream &out) {
+  out << "Allocations: ";
+  printStageCounts(out, stageCounts);
+  for (ThreadCounts &thread : threads) {
+    pid_t tid = thread.tid.load();
+    if (tid == 0) continue;
+    out << "  thread " << tid << " (" << threadName(tid) << "): ";
+    printStageCounts(out, thread.counts);
+  }
+
+  // copied out first so a hot thread recording a site doesn't spin while this symbolizes
+  lockSites();
+  std::vector<Site> hotSites(sites, sites + siteCount);
+  unsigned long dropped = sitesDropped;
+  unlockSites();
+
+  if (hotSites.empty()) {
+    out << "No allocations on the hot path\n";
+    return;
+  }
+  out << "Hot path allocation sites (resolve offsets with addr2line -e <binary>):\n";
+  for (const Site &site : hotSites) {
+    out << "  " << stageNames[site.stage] << ", " << site.count << "x:\n";
+#ifdef __GLIBC__
+    char **symbols = backtrace_symbols(site.frames, site.depth);
+    for (int f = 0; symbols && f < site.depth; f++) out << "    " << symbols[f] << "\n";
+    free(symbols);
+#endif
+  }
+  if (dropped) out << "  (" << dropped << " more allocations at unrecorded sites)\n";
+}
+
+#endif // WAYVIBES_ALLOC_TRACKING
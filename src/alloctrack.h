@@ -0,0 +1,44 @@
+#ifndef ALLOCTRACK_H
+#define ALLOCTRACK_H
+
+// Allocation tracking build mode (-DWAYVIBES_ALLOC_TRACKING, `make ALLOC_TRACKING=1`):
+// malloc and operator new are interposed and every allocation is counted against the
+// calling thread and the pipeline stage it happens in. The input and audio stages must not
+// allocate once warmed up; allocations there also record their call stack for the report.
+// Outside glibc only operator new is counted, without call stacks.
+// Without the flag the stage markers compile to nothing.
+
+#include <ostream>
+
+enum AllocStage {
+  ALLOC_STAGE_OTHER, // setup, reloads, control requests: free to allocate
+  ALLOC_STAGE_INPUT, // reading and dispatching input events
+  ALLOC_STAGE_AUDIO, // rendering a period
+  ALLOC_STAGE_COUNT
+};
+
+#ifdef WAYVIBES_ALLOC_TRACKING
+
+// Attributes this thread's allocations to `stage` until the end of the scope
+struct AllocStageScope {
+  AllocStage previous;
+  explicit AllocStageScope(AllocStage stage);
+  ~AllocStageScope();
+};
+#define ALLOC_STAGE(stage) AllocStageScope allocStageScope_(stage)
+
+// Forget counts and sites so far, e.g. once warmed up
+void resetAllocationCounts();
+
+// Allocations in `stage` since the last reset, over all threads
+unsigned long allocationCount(AllocStage stage);
+unsigned long allocationCount(); // all stages
+
+// Per-stage and per-thread counts, then the call stacks of hot path allocations
+void printAllocationReport(std::ostream &out);
+
+#else
+#define ALLOC_STAGE(stage) ((void)0)
+#endif
+
+#endif // ALLOCTRACK_H
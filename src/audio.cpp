@@ -1,138 +1,848 @@
 #define MINIAUDIO_IMPLEMENTATION
 #include "audio.h"
+#include "alloctrack.h"
 #include "miniaudio.h"
-#include <fcntl.h>
-#include <iostream>
+#include "stats.h"
+#include "synth.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <linux/input.h>
-#include <poll.h>
-#include <sys/ioctl.h>
-#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-ma_engine engine;
+#define MAX_VOICES 64
+#define TRIGGER_QUEUE_SIZE 256 // must be a power of two
+#define EXPAND_BUFFER_SIZE 2048 // values expanded per chunk of a compact sample
+#define LIMITER_CEILING 0.98f
+#define LIMITER_RELEASE_MS 50.0f
+#define LOAD_WINDOW_MS 1000.0f // time constant of the rolling callback load
+#define OVERRUN_LOG_SIZE 16    // must be a power of two
+#define MIN_VOICE_CAP 8
+#define SHED_HOLD_MS 30000 // voice cap kept after the last overrun
+#define TAIL_FADE_MS 10     // fade of voices cut by setPlaybackLimits()
+#define MIX_BUFFER_SIZE 8192 // values per render pass; longer callbacks are rendered in parts
 
-ma_result initializeAudioEngine() { return ma_engine_init(NULL, &engine); }
+struct Trigger {
+  const Sample *sample;
+  long long timeNs;
+  Retrigger retrigger;
+  unsigned generation; // of the soundpack that owns the sample
+};
 
-void uninitializeAudioEngine() { ma_engine_uninit(&engine); }
+struct Voice {
+  const Sample *sample;
+  ma_uint64 cursor;
+  ma_uint64 startFrame; // output frame the sample starts at
+  ma_uint64 fadeStart;  // output frame a choke fade starts at
+  ma_uint32 fadeLength; // 0 = not fading
+  unsigned id;          // trigger serial, tells a reused slot from the voice a group tracks
+  unsigned generation;
+  bool active;
+  SynthVoice synth; // rendering state of a SAMPLE_SYNTH sample
+};
 
-void playSound(const std::string &soundFile) {
-  if (ma_engine_play_sound(&engine, soundFile.c_str(), NULL) != MA_SUCCESS) {
-    std::cerr << "Error playing sound: " << soundFile << std::endl;
+// Most recent voices started in a choke group
+struct GroupState {
+  int voice[MAX_STACK_LIMIT];
+  unsigned id[MAX_STACK_LIMIT];
+  unsigned count;
+};
+
+ma_device device;
+
+// Single producer (input loop) / single consumer (audio callback) trigger ring
+static Trigger triggerQueue[TRIGGER_QUEUE_SIZE];
+static std::atomic<unsigned> triggerHead{0};
+static std::atomic<unsigned> triggerTail{0};
+
+// Only touched by the audio callback
+static Voice voices[MAX_VOICES];
+static GroupState groups[KEY_CNT];
+static unsigned nextVoiceId = 1;
+static ma_uint64 framesRendered = 0;
+static long long clockBaseNs = 0; // CLOCK_MONOTONIC time of output frame 0
+static float expandBuffer[EXPAND_BUFFER_SIZE];
+static int16_t expandBuffer16[EXPAND_BUFFER_SIZE]; // the same for the integer mixer
+static struct UlawTable {
+  float value[256];
+  int16_t value16[256];
+  UlawTable() {
+    for (int i = 0; i < 256; i++) {
+      value[i] = ulawToFloat((unsigned char)i);
+      value16[i] = (int16_t)std::lrint(value[i] * 32768.0f);
+    }
+  }
+} ulawTable;
+static int32_t mixAccumulator[MIX_BUFFER_SIZE]; // integer mixer sums, int16 scale
+static float floatScratch[MIX_BUFFER_SIZE];     // f32 mix bound for an s16 device
+static int16_t s16Scratch[MIX_BUFFER_SIZE];     // integer mix bound for an f32 device
+static float limiterGain = 1.0f;
+static long long deviceBufferNs = 0; // audio the device holds, 0 = unknown
+static float callbackLoad = 0.0f;     // rolling callback duration / period
+static int voiceCap = MAX_VOICES;
+static ma_uint64 voiceCapUntil = 0; // output frame the cap is lifted at
+
+// Single producer (audio callback) / single consumer (daemon loop) overrun log
+static AudioOverrun overrunLog[OVERRUN_LOG_SIZE];
+static std::atomic<unsigned> overrunHead{0};
+static std::atomic<unsigned> overrunTail{0};
+
+// Soundpack generation the input loop triggers from, and the oldest one the mixer still
+// references; older soundpacks can be freed
+static std::atomic<unsigned> currentGeneration{0};
+static std::atomic<unsigned> liveGeneration{0};
+
+static std::atomic<float> masterVolume{1.0f};
+static std::atomic<bool> muted{false};
+static std::atomic<long long> scheduledLatencyNs{0};
+static std::atomic<bool> rerouted{false};
+static std::atomic<bool> interrupted{false};
+static std::atomic<bool> shedVoices{false};
+static std::atomic<int> voiceLimit{MAX_VOICES};
+static std::atomic<unsigned> tailLimitMs{0};
+static std::atomic<bool> integerMix{false};
+static bool s16Output = false; // open devices in s16 while mixing in float, too
+static bool nullBackend = false;
+static ma_context nullContext; // initialized with the first device on the null backend
+static bool nullContextReady = false;
+
+static long long monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Track the mapping between output frames and monotonic time. Late callback wakeups only
+// push the anchor forward, so follow decreases immediately and increases slowly; the slow
+// path absorbs drift between the audio clock and CLOCK_MONOTONIC. A callback later than the
+// device buffer lasts means the device ran dry: returns by how much, after resyncing.
+static long long updateClockBase(ma_uint32 sampleRate, ma_uint32 frameCount) {
+  long long anchor =
+      monotonicNs() - (long long)(framesRendered * 1000000000ULL / sampleRate);
+  long long bufferNs =
+      deviceBufferNs ? deviceBufferNs : 2LL * frameCount * 1000000000LL / sampleRate;
+  long long lateNs = 0;
+  if (framesRendered == 0 || anchor < clockBaseNs) {
+    clockBaseNs = anchor;
+  } else if (anchor - clockBaseNs > bufferNs) {
+    lateNs = anchor - clockBaseNs;
+    clockBaseNs = anchor; // the device played silence meanwhile
+  } else {
+    clockBaseNs += (anchor - clockBaseNs) / 256;
+  }
+  return lateNs;
+}
+
+static void logOverrun(long long durationNs, long long budgetNs, unsigned voices,
+                       bool underrun) {
+  unsigned head = overrunHead.load(std::memory_order_relaxed);
+  if (head - overrunTail.load(std::memory_order_acquire) >= OVERRUN_LOG_SIZE) return;
+  overrunLog[head & (OVERRUN_LOG_SIZE - 1)] = {monotonicNs(), (unsigned)(durationNs / 1000),
+                                               (unsigned)(budgetNs / 1000), voices, underrun};
+  overrunHead.store(head + 1, std::memory_order_release);
+}
+
+// Compare the callback's duration against its period: rolling load, overruns, voice cap
+static void watchDeadline(long long durationNs, ma_uint32 frameCount, ma_uint32 sampleRate,
+                          unsigned voices) {
+  long long budgetNs = (long long)frameCount * 1000000000LL / sampleRate;
+  if (budgetNs <= 0) return;
+  float alpha = std::min(1.0f, (float)budgetNs / (LOAD_WINDOW_MS * 1000000.0f));
+  callbackLoad += alpha * ((float)durationNs / budgetNs - callbackLoad);
+  stats.callbackLoadPermille.store((unsigned long)(callbackLoad * 1000.0f),
+                                   std::memory_order_relaxed);
+
+  if (durationNs > budgetNs) {
+    count(stats.overruns);
+    stats.overrunVoices.store(voices, std::memory_order_relaxed);
+    logOverrun(durationNs, budgetNs, voices, false);
+    if (shedVoices.load(std::memory_order_relaxed)) {
+      voiceCap = std::max(MIN_VOICE_CAP, (int)voices * 3 / 4);
+      voiceCapUntil = framesRendered + (ma_uint64)SHED_HOLD_MS * sampleRate / 1000;
+    }
+  } else if (voiceCap < MAX_VOICES && framesRendered >= voiceCapUntil) {
+    voiceCap = MAX_VOICES;
+  }
+  stats.voiceCap.store(std::min(voiceCap, voiceLimit.load(std::memory_order_relaxed)),
+                       std::memory_order_relaxed);
+}
+
+static ma_uint64 triggerStartFrame(const Trigger &trigger, ma_uint32 sampleRate) {
+  long long latencyNs = scheduledLatencyNs.load(std::memory_order_relaxed);
+  if (latencyNs <= 0 || trigger.timeNs <= 0) return framesRendered;
+
+  long long startNs = trigger.timeNs + latencyNs - clockBaseNs;
+  // no later than the latency from now, give or take what the device buffers; in double,
+  // so a timestamp from another clock can't overflow the conversion either
+  double startFrame = (double)startNs * sampleRate / 1e9;
+  double latestFrame =
+      (double)framesRendered + (double)(latencyNs + deviceBufferNs) * sampleRate / 1e9;
+  if (startFrame > latestFrame) return (ma_uint64)latestFrame;
+  if (startFrame < (double)framesRendered) {
+    count(stats.lateTriggers);
+    return framesRendered;
   }
+  return (ma_uint64)startFrame;
 }
 
-void setVolume(float volume) { ma_engine_set_volume(&engine, volume); }
+// Voice a group started `age` triggers ago, if it is still ringing
+static Voice *groupVoice(const GroupState &group, unsigned age) {
+  if (age == 0 || age > group.count || age > MAX_STACK_LIMIT) return nullptr;
+  unsigned slot = (group.count - age) % MAX_STACK_LIMIT;
+  Voice &voice = voices[group.voice[slot]];
+  return voice.active && voice.id == group.id[slot] ? &voice : nullptr;
+}
 
-void runMainLoop(const std::string &devicePath,
-                 const std::unordered_map<int, std::string> &keySoundMap, float volume,
-                 const std::string &soundpackPath) {
-  int fd = open(devicePath.c_str(), O_RDONLY | O_NONBLOCK);
-  if (fd < 0) {
-    std::cerr << "Failed to open input device: " << devicePath << std::endl;
+// Fade a voice out from `at`; a voice that would not be heard before then is dropped
+static void chokeVoice(Voice &voice, ma_uint64 at, ma_uint32 fadeFrames) {
+  if (at <= voice.startFrame) {
+    voice.active = false;
     return;
   }
+  if (voice.fadeLength && voice.fadeStart <= at) return; // already fading earlier
+  voice.fadeStart = at;
+  voice.fadeLength = fadeFrames ? fadeFrames : 1;
+}
 
-  setVolume(volume);
+static void startVoice(const Trigger &trigger, ma_uint32 sampleRate) {
+  const Retrigger &policy = trigger.retrigger;
+  GroupState &group = groups[policy.group];
+  ma_uint64 startFrame = triggerStartFrame(trigger, sampleRate);
 
-  std::cout << "Listening for key events on: " << devicePath << std::endl;
+  Voice *voice = nullptr;
+  if (policy.mode == RETRIGGER_RESTART) {
+    Voice *previous = groupVoice(group, 1);
+    if (previous && startFrame == framesRendered) {
+      voice = previous; // restart in place
+    } else if (previous) {
+      chokeVoice(*previous, startFrame, 1); // scheduled: cut it when the new one starts
+    }
+  } else {
+    unsigned maxStack = policy.mode == RETRIGGER_CHOKE ? 1 : policy.maxStack;
+    Voice *oldest = maxStack ? groupVoice(group, maxStack) : nullptr;
+    if (oldest) chokeVoice(*oldest, startFrame, policy.fadeFrames);
+  }
 
-  struct input_event ev;
-  while (true) {
-    ssize_t n = read(fd, &ev, sizeof(ev));
-    if (n == sizeof(ev)) {
-      if (ev.type == EV_KEY && ev.value == 1) { // key press
-        auto it = keySoundMap.find(ev.code);
-        if (it != keySoundMap.end()) {
-          std::string soundFile = soundpackPath + "/" + it->second;
-          playSound(soundFile);
-        }
+  int active = 0;
+  Voice *idle = nullptr;
+  for (int i = 0; i < MAX_VOICES; i++) {
+    if (voices[i].active) {
+      active++;
+    } else if (!idle) {
+      idle = &voices[i];
+    }
+  }
+  if (!voice && active < std::min(voiceCap, voiceLimit.load(std::memory_order_relaxed))) {
+    voice = idle;
+  }
+  if (!voice) {
+    // all busy (or capped): steal the playing voice that started first, so the count of
+    // playing voices stays where it is
+    count(stats.voiceSteals);
+    trace(TRACE_INSTANT, "voice steal");
+    for (int i = 0; i < MAX_VOICES; i++) {
+      if (voices[i].active && (!voice || voices[i].startFrame < voice->startFrame)) {
+        voice = &voices[i];
       }
-    } else {
-      usleep(1000); // sleep 1ms to avoid busy loop
     }
   }
 
-  close(fd);
+  voice->sample = trigger.sample;
+  voice->cursor = 0;
+  voice->startFrame = startFrame;
+  if (trigger.sample->format == SAMPLE_SYNTH) {
+    startSynthVoice(voice->synth, *(const SynthSound *)trigger.sample->data.data(), sampleRate,
+                    nextVoiceId ^ (unsigned)trigger.timeNs);
+  }
+  long long latencyNs = 0;
+  if (trigger.timeNs > 0) {
+    latencyNs =
+        clockBaseNs + (long long)(startFrame * 1000000000ULL / sampleRate) - trigger.timeNs;
+    recordLatency(latencyNs);
+  }
+  trace(TRACE_FLOW_END, "key press", nullptr, 0, traceFlowId(trigger.sample, trigger.timeNs));
+  trace(TRACE_INSTANT, "voice start", "latency_us", latencyNs / 1000);
+  voice->fadeLength = 0;
+  voice->id = nextVoiceId++;
+  voice->generation = trigger.generation;
+  voice->active = true;
+
+  unsigned slot = group.count % MAX_STACK_LIMIT;
+  group.voice[slot] = (int)(voice - voices);
+  group.id[slot] = voice->id;
+  group.count++;
 }
 
-void runMainLoopMulti(const std::string &keyboardDevicePath,
-                     const std::string &mouseDevicePath,
-                     const std::unordered_map<int, std::string> &keySoundMap,
-                     float volume, const std::string &soundpackPath) {
-  int kfd = -1, mfd = -1;
+// Values of a sample at [first, first + count) as f32: f32 samples are used in place,
+// compact formats are expanded into expandBuffer
+static const float *expandSample(const Sample &sample, ma_uint64 first, ma_uint32 count) {
+  if (sample.format == SAMPLE_F32) return (const float *)sample.data.data() + first;
 
-  if (!keyboardDevicePath.empty()) {
-    kfd = open(keyboardDevicePath.c_str(), O_RDONLY | O_NONBLOCK);
-    if (kfd < 0) {
-      std::cerr << "Failed to open keyboard device: " << keyboardDevicePath << std::endl;
-    } else {
-      std::cout << "Listening for key events on: " << keyboardDevicePath << std::endl;
+  ma_uint32 i = 0;
+  if (sample.format == SAMPLE_S16) {
+    const int16_t *src = (const int16_t *)sample.data.data() + first;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= count; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      // sign-extend by placing each value in the high half of a 32-bit lane
+      __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      _mm_storeu_ps(expandBuffer + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+      _mm_storeu_ps(expandBuffer + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+      int16x8_t v = vld1q_s16(src + i);
+      vst1q_f32(expandBuffer + i,
+                vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), 1.0f / 32768.0f));
+      vst1q_f32(expandBuffer + i + 4,
+                vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), 1.0f / 32768.0f));
     }
+#endif
+    for (; i < count; i++) expandBuffer[i] = src[i] * (1.0f / 32768.0f);
+  } else {
+    const unsigned char *src = sample.data.data() + first;
+    for (; i < count; i++) expandBuffer[i] = ulawTable.value[src[i]];
   }
+  return expandBuffer;
+}
+
+// Mix the frames the voice plays in this period, returns how many it played. Levels are
+// baked into the samples, so outside of fades this only adds.
+static ma_uint32 mixVoice(Voice &voice, float *out, ma_uint32 frameCount, ma_uint32 channels) {
+  ma_uint64 blockEnd = framesRendered + frameCount;
+  if (voice.startFrame >= blockEnd) return 0;
 
-  if (!mouseDevicePath.empty()) {
-    mfd = open(mouseDevicePath.c_str(), O_RDONLY | O_NONBLOCK);
-    if (mfd < 0) {
-      std::cerr << "Failed to open mouse device: " << mouseDevicePath << std::endl;
+  const Sample &sample = *voice.sample;
+  if (sample.channels != 1 && sample.channels != channels) {
+    voice.active = false; // converted for a previous device format
+    return 0;
+  }
+  ma_uint32 offset =
+      voice.startFrame > framesRendered ? (ma_uint32)(voice.startFrame - framesRendered) : 0;
+  ma_uint64 remaining = sample.frameCount - voice.cursor;
+  ma_uint32 n = frameCount - offset;
+  if (remaining < n) n = (ma_uint32)remaining;
+
+  // mono samples are spread over the output channels here, at the final mix
+  ma_uint32 sampleChannels = sample.channels;
+  ma_uint32 chunkFrames = EXPAND_BUFFER_SIZE / sampleChannels;
+  float *dst = out + offset * channels;
+  ma_uint64 firstFrame = framesRendered + offset;
+  bool fading = voice.fadeLength != 0 && voice.fadeStart < firstFrame + n;
+
+  for (ma_uint32 done = 0; done < n;) {
+    ma_uint32 count = std::min(n - done, chunkFrames);
+    const float *src = expandBuffer;
+    if (sample.format == SAMPLE_SYNTH) {
+      renderSynth(voice.synth, expandBuffer, count); // always mono
     } else {
-      std::cout << "Listening for mouse events on: " << mouseDevicePath << std::endl;
+      src = expandSample(sample, (voice.cursor + done) * sampleChannels, count * sampleChannels);
     }
-  }
 
-  if (kfd < 0 && mfd < 0) {
-    std::cerr << "No input devices available to listen on." << std::endl;
-    return;
+    if (!fading && sampleChannels == channels) {
+      for (ma_uint32 s = 0; s < count * channels; s++) dst[s] += src[s];
+    } else if (!fading) {
+      for (ma_uint32 f = 0; f < count; f++) {
+        for (ma_uint32 c = 0; c < channels; c++) dst[f * channels + c] += src[f];
+      }
+    } else {
+      for (ma_uint32 f = 0; f < count; f++) {
+        float gain = 1.0f;
+        ma_uint64 frame = firstFrame + done + f;
+        if (frame >= voice.fadeStart) {
+          ma_uint64 faded = frame - voice.fadeStart;
+          if (faded >= voice.fadeLength) {
+            voice.active = false;
+            return done + f;
+          }
+          gain *= 1.0f - (float)faded / voice.fadeLength;
+        }
+        for (ma_uint32 c = 0; c < channels; c++) {
+          dst[f * channels + c] += src[f * sampleChannels + (sampleChannels == 1 ? 0 : c)] * gain;
+        }
+      }
+    }
+
+    dst += count * channels;
+    done += count;
   }
 
-  setVolume(volume);
+  voice.cursor += n;
+  if (voice.cursor >= sample.frameCount) voice.active = false;
+  return n;
+}
 
-  struct pollfd fds[2];
-  int nfds = 0;
+// f32 values as int16, saturated
+static void floatToS16(const float *src, int16_t *dst, ma_uint32 count) {
+  ma_uint32 i = 0;
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  const __m128 low = _mm_set1_ps(-32768.0f), high = _mm_set1_ps(32767.0f);
+  for (; i + 8 <= count; i += 8) {
+    // clamped first: out of range conversions return INT_MIN whatever the sign
+    __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), scale), low), high);
+    __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4), scale), low), high);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] = (int16_t)std::lrint(std::clamp(src[i] * 32768.0f, -32768.0f, 32767.0f));
+  }
+}
 
-  if (kfd >= 0) {
-    fds[nfds].fd = kfd;
-    fds[nfds].events = POLLIN;
-    nfds++;
+// Values of a sample at [first, first + count) as int16: s16 samples are used in place,
+// other formats are converted into expandBuffer16
+static const int16_t *expandSampleS16(Voice &voice, const Sample &sample, ma_uint64 first,
+                                      ma_uint32 count) {
+  if (sample.format == SAMPLE_S16) return (const int16_t *)sample.data.data() + first;
+  if (sample.format == SAMPLE_ULAW) {
+    const unsigned char *src = sample.data.data() + first;
+    for (ma_uint32 i = 0; i < count; i++) expandBuffer16[i] = ulawTable.value16[src[i]];
+  } else if (sample.format == SAMPLE_SYNTH) {
+    renderSynth(voice.synth, expandBuffer, count);
+    floatToS16(expandBuffer, expandBuffer16, count);
+  } else {
+    floatToS16((const float *)sample.data.data() + first, expandBuffer16, count);
   }
+  return expandBuffer16;
+}
 
-  if (mfd >= 0) {
-    fds[nfds].fd = mfd;
-    fds[nfds].events = POLLIN;
-    nfds++;
+// acc[i] += src[i], widening to int32
+static void accumulateS16(int32_t *acc, const int16_t *src, ma_uint32 count) {
+  ma_uint32 i = 0;
+#if defined(__AVX2__)
+  for (; i + 16 <= count; i += 16) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+    __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+    _mm256_storeu_si256((__m256i *)(acc + i),
+                        _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(acc + i)), lo));
+    _mm256_storeu_si256((__m256i *)(acc + i + 8),
+                        _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(acc + i + 8)), hi));
+  }
+#elif defined(__SSE2__)
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_si128((__m128i *)(acc + i),
+                     _mm_add_epi32(_mm_loadu_si128((__m128i *)(acc + i)), lo));
+    _mm_storeu_si128((__m128i *)(acc + i + 4),
+                     _mm_add_epi32(_mm_loadu_si128((__m128i *)(acc + i + 4)), hi));
   }
+#elif defined(__ARM_NEON)
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t v = vld1q_s16(src + i);
+    vst1q_s32(acc + i, vaddw_s16(vld1q_s32(acc + i), vget_low_s16(v)));
+    vst1q_s32(acc + i + 4, vaddw_s16(vld1q_s32(acc + i + 4), vget_high_s16(v)));
+  }
+#endif
+  for (; i < count; i++) acc[i] += src[i];
+}
+
+// Integer version of mixVoice(): int16 values summed into int32, fades as Q15 gains
+static ma_uint32 mixVoiceS16(Voice &voice, int32_t *acc, ma_uint32 frameCount,
+                             ma_uint32 channels) {
+  ma_uint64 blockEnd = framesRendered + frameCount;
+  if (voice.startFrame >= blockEnd) return 0;
+
+  const Sample &sample = *voice.sample;
+  if (sample.channels != 1 && sample.channels != channels) {
+    voice.active = false;
+    return 0;
+  }
+  ma_uint32 offset =
+      voice.startFrame > framesRendered ? (ma_uint32)(voice.startFrame - framesRendered) : 0;
+  ma_uint64 remaining = sample.frameCount - voice.cursor;
+  ma_uint32 n = frameCount - offset;
+  if (remaining < n) n = (ma_uint32)remaining;
 
-  struct input_event ev;
-  while (true) {
-    int ret = poll(fds, nfds, 50);  // 50ms timeout
+  ma_uint32 sampleChannels = sample.channels;
+  ma_uint32 chunkFrames = EXPAND_BUFFER_SIZE / sampleChannels;
+  int32_t *dst = acc + offset * channels;
+  ma_uint64 firstFrame = framesRendered + offset;
+  bool fading = voice.fadeLength != 0 && voice.fadeStart < firstFrame + n;
 
-    if (ret > 0) {
-      for (int i = 0; i < nfds; ++i) {
-        if (fds[i].revents & POLLIN) {
-          int fd = fds[i].fd;
-          ssize_t n = read(fd, &ev, sizeof(ev));
+  for (ma_uint32 done = 0; done < n;) {
+    ma_uint32 count = std::min(n - done, chunkFrames);
+    const int16_t *src = expandSampleS16(voice, sample, (voice.cursor + done) * sampleChannels,
+                                         count * sampleChannels);
 
-          if (n == sizeof(ev)) {
-            if (ev.type == EV_KEY && ev.value == 1) {
-              // Key or mouse button press
-              auto it = keySoundMap.find(ev.code);
-              if (it != keySoundMap.end()) {
-                std::string soundFile = soundpackPath + "/" + it->second;
-                playSound(soundFile);
-              }
-            }
+    if (!fading && sampleChannels == channels) {
+      accumulateS16(dst, src, count * channels);
+    } else if (!fading) {
+      for (ma_uint32 f = 0; f < count; f++) {
+        for (ma_uint32 c = 0; c < channels; c++) dst[f * channels + c] += src[f];
+      }
+    } else {
+      for (ma_uint32 f = 0; f < count; f++) {
+        int32_t gain = 32768; // Q15
+        ma_uint64 frame = firstFrame + done + f;
+        if (frame >= voice.fadeStart) {
+          ma_uint64 faded = frame - voice.fadeStart;
+          if (faded >= voice.fadeLength) {
+            voice.active = false;
+            return done + f;
           }
+          gain = (int32_t)(((voice.fadeLength - faded) << 15) / voice.fadeLength);
+        }
+        for (ma_uint32 c = 0; c < channels; c++) {
+          int32_t value = src[f * sampleChannels + (sampleChannels == 1 ? 0 : c)];
+          dst[f * channels + c] += (value * gain + (1 << 14)) >> 15;
         }
       }
     }
 
-    // Small sleep to avoid busy loop when no events
-    usleep(1000);
+    dst += count * channels;
+    done += count;
   }
 
-  if (kfd >= 0) {
-    close(kfd);
+  voice.cursor += n;
+  if (voice.cursor >= sample.frameCount) voice.active = false;
+  return n;
+}
+
+// Master volume, then a look-ahead-free peak limiter: the gain drops at once to keep a
+// frame under the ceiling and recovers exponentially, so summed voices and high volume
+// settings don't clip
+static void applyMasterBus(float *out, ma_uint32 frameCount, ma_uint32 channels,
+                           ma_uint32 sampleRate, float volume) {
+  ma_uint32 samples = frameCount * channels;
+  float blockPeak = 0.0f;
+  for (ma_uint32 s = 0; s < samples; s++) blockPeak = std::max(blockPeak, std::fabs(out[s]));
+
+  if (limiterGain == 1.0f && blockPeak * volume <= LIMITER_CEILING) {
+    for (ma_uint32 s = 0; s < samples; s++) out[s] *= volume;
+    return;
   }
 
-  if (mfd >= 0) {
-    close(mfd);
+  float release = 1.0f - std::exp(-1000.0f / (LIMITER_RELEASE_MS * sampleRate));
+  unsigned long limited = 0;
+  for (ma_uint32 f = 0; f < frameCount; f++) {
+    float *frame = out + f * channels;
+    float peak = 0.0f;
+    for (ma_uint32 c = 0; c < channels; c++) peak = std::max(peak, std::fabs(frame[c]));
+    peak *= volume;
+
+    float gain = limiterGain + (1.0f - limiterGain) * release;
+    if (peak * gain > LIMITER_CEILING) {
+      gain = LIMITER_CEILING / peak;
+      limited++;
+    }
+    limiterGain = gain > 0.9999f ? 1.0f : gain;
+    for (ma_uint32 c = 0; c < channels; c++) frame[c] *= gain * volume;
   }
-}
\ No newline at end of file
+  if (limited) count(stats.limitedFrames, limited);
+}
+
+// applyMasterBus() for the integer mixer: the same limiter, its gains applied in Q15 to the
+// int32 sums, which are then packed to int16 with saturation
+static void applyMasterBusS16(int32_t *acc, int16_t *out, ma_uint32 frameCount,
+                              ma_uint32 channels, ma_uint32 sampleRate, float volume) {
+  ma_uint32 samples = frameCount * channels;
+  int32_t blockPeak = 0;
+  for (ma_uint32 s = 0; s < samples; s++) blockPeak = std::max(blockPeak, std::abs(acc[s]));
+
+  // sums past full scale are expected, the gain brings them back; volume may exceed 1
+  auto scale = [](int32_t *values, ma_uint32 count, int64_t gainQ15) {
+    for (ma_uint32 s = 0; s < count; s++) {
+      values[s] = (int32_t)std::clamp<int64_t>((values[s] * gainQ15 + (1 << 14)) >> 15,
+                                               INT32_MIN, INT32_MAX);
+    }
+  };
+  float ceiling = LIMITER_CEILING * 32768.0f;
+  if (limiterGain == 1.0f && blockPeak * volume <= ceiling) {
+    scale(acc, samples, std::lrint(volume * 32768.0f));
+  } else {
+    float release = 1.0f - std::exp(-1000.0f / (LIMITER_RELEASE_MS * sampleRate));
+    unsigned long limited = 0;
+    for (ma_uint32 f = 0; f < frameCount; f++) {
+      int32_t *frame = acc + f * channels;
+      int32_t framePeak = 0;
+      for (ma_uint32 c = 0; c < channels; c++) framePeak = std::max(framePeak, std::abs(frame[c]));
+      float peak = framePeak * volume;
+
+      float gain = limiterGain + (1.0f - limiterGain) * release;
+      if (peak * gain > ceiling) {
+        gain = ceiling / peak;
+        limited++;
+      }
+      limiterGain = gain > 0.9999f ? 1.0f : gain;
+      scale(frame, channels, std::lrint(gain * volume * 32768.0f));
+    }
+    if (limited) count(stats.limitedFrames, limited);
+  }
+
+  ma_uint32 s = 0;
+#if defined(__SSE2__)
+  for (; s + 8 <= samples; s += 8) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(acc + s));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(acc + s + 4));
+    _mm_storeu_si128((__m128i *)(out + s), _mm_packs_epi32(lo, hi));
+  }
+#elif defined(__ARM_NEON)
+  for (; s + 8 <= samples; s += 8) {
+    vst1q_s16(out + s, vcombine_s16(vqmovn_s32(vld1q_s32(acc + s)),
+                                    vqmovn_s32(vld1q_s32(acc + s + 4))));
+  }
+#endif
+  for (; s < samples; s++) out[s] = (int16_t)std::clamp(acc[s], -32768, 32767);
+}
+
+// Mix and finish at most MIX_BUFFER_SIZE values into exactly one of the outputs, with the
+// float or the integer mixer, converting at the end if they differ; returns the voices still
+// playing. Lowers oldestGeneration to that of any voice still playing.
+static unsigned long renderPass(float *outF32, int16_t *outS16, ma_uint32 frameCount,
+                                ma_uint32 channels, ma_uint32 sampleRate, float volume,
+                                bool integer, unsigned &oldestGeneration) {
+  // voices that play past the tail limit fade out, from now at the latest
+  ma_uint64 tailFrames =
+      (ma_uint64)tailLimitMs.load(std::memory_order_relaxed) * sampleRate / 1000;
+  ma_uint64 blockEnd = framesRendered + frameCount;
+
+  ma_uint32 samples = frameCount * channels;
+  float *mix = outF32;
+  if (integer) {
+    memset(mixAccumulator, 0, samples * sizeof(int32_t));
+  } else if (!mix) {
+    mix = floatScratch;
+    memset(mix, 0, samples * sizeof(float));
+  }
+
+  long long mixStartNs = monotonicNs();
+  unsigned long activeVoices = 0;
+  ma_uint64 voiceFrames = 0;
+  for (int i = 0; i < MAX_VOICES; i++) {
+    if (!voices[i].active) continue;
+    if (tailFrames && voices[i].startFrame + tailFrames < blockEnd) {
+      chokeVoice(voices[i], std::max(voices[i].startFrame + tailFrames, framesRendered),
+                 TAIL_FADE_MS * sampleRate / 1000);
+    }
+    voiceFrames += integer ? mixVoiceS16(voices[i], mixAccumulator, frameCount, channels)
+                           : mixVoice(voices[i], mix, frameCount, channels);
+    if (!voices[i].active) continue;
+    activeVoices++;
+    if (voices[i].generation < oldestGeneration) oldestGeneration = voices[i].generation;
+  }
+  if (voiceFrames) {
+    count(stats.mixTimeNs, monotonicNs() - mixStartNs);
+    count(stats.voiceTimeNs, voiceFrames * 1000000000ULL / sampleRate);
+  }
+
+  if (integer) {
+    int16_t *out = outS16 ? outS16 : s16Scratch;
+    applyMasterBusS16(mixAccumulator, out, frameCount, channels, sampleRate, volume);
+    if (outF32) {
+      for (ma_uint32 s = 0; s < samples; s++) outF32[s] = out[s] * (1.0f / 32768.0f);
+    }
+  } else {
+    applyMasterBus(mix, frameCount, channels, sampleRate, volume);
+    if (outS16) floatToS16(mix, outS16, samples);
+  }
+
+  framesRendered += frameCount;
+  return activeVoices;
+}
+
+// One device callback into whichever output is given. Periods beyond the mix buffers are
+// rare (over 40 ms of stereo) and mixed in several passes, but timed and traced as one.
+static void renderCallback(float *outF32, int16_t *outS16, ma_uint32 frameCount,
+                           ma_uint32 channels, ma_uint32 sampleRate) {
+  ALLOC_STAGE(ALLOC_STAGE_AUDIO);
+  trace(TRACE_BEGIN, "audio callback", "frames", frameCount);
+  long long callbackStartNs = monotonicNs();
+  long long lateNs = updateClockBase(sampleRate, frameCount);
+  if (lateNs || (interrupted.load(std::memory_order_relaxed) && interrupted.exchange(false))) {
+    count(stats.xruns);
+    logOverrun(lateNs, (long long)frameCount * 1000000000LL / sampleRate,
+               (unsigned)stats.activeVoices.load(std::memory_order_relaxed), true);
+  }
+
+  // loaded before draining the queue: triggers of older soundpacks were queued before
+  // this generation was published
+  unsigned oldestGeneration = currentGeneration.load(std::memory_order_acquire);
+
+  unsigned tail = triggerTail.load(std::memory_order_relaxed);
+  unsigned head = triggerHead.load(std::memory_order_acquire);
+  while (tail != head) {
+    startVoice(triggerQueue[tail & (TRIGGER_QUEUE_SIZE - 1)], sampleRate);
+    tail++;
+  }
+  triggerTail.store(tail, std::memory_order_release);
+
+  float volume = muted.load(std::memory_order_relaxed)
+                     ? 0.0f
+                     : masterVolume.load(std::memory_order_relaxed);
+  bool integer = integerMix.load(std::memory_order_relaxed);
+
+  unsigned long activeVoices = 0;
+  ma_uint32 passFrames = MIX_BUFFER_SIZE / channels;
+  for (ma_uint32 done = 0; done < frameCount; done += passFrames) {
+    activeVoices = renderPass(outF32 ? outF32 + done * channels : NULL,
+                              outS16 ? outS16 + done * channels : NULL,
+                              std::min(frameCount - done, passFrames), channels, sampleRate,
+                              volume, integer, oldestGeneration);
+  }
+  stats.activeVoices.store(activeVoices, std::memory_order_relaxed);
+
+  liveGeneration.store(oldestGeneration, std::memory_order_release);
+  long long durationNs = monotonicNs() - callbackStartNs;
+  recordCallbackTime(durationNs);
+  watchDeadline(durationNs, frameCount, sampleRate, activeVoices);
+  trace(TRACE_END, "audio callback", "voices", (long long)activeVoices);
+}
+
+void renderAudio(float *out, ma_uint32 frameCount, ma_uint32 channels, ma_uint32 sampleRate) {
+  renderCallback(out, NULL, frameCount, channels, sampleRate);
+}
+
+void renderAudioS16(int16_t *out, ma_uint32 frameCount, ma_uint32 channels,
+                    ma_uint32 sampleRate) {
+  renderCallback(NULL, out, frameCount, channels, sampleRate);
+}
+
+static void dataCallback(ma_device *pDevice, void *pOutput, const void *pInput,
+                         ma_uint32 frameCount) {
+  (void)pInput; // playback only
+  static thread_local bool named = false;
+  if (!named) {
+    // tells the audio thread apart in traces, top and perf
+    pthread_setname_np(pthread_self(), "wayvibes-audio");
+    named = true;
+  }
+  if (pDevice->playback.format == ma_format_s16) {
+    renderAudioS16((int16_t *)pOutput, frameCount, pDevice->playback.channels,
+                   pDevice->sampleRate);
+  } else {
+    renderAudio((float *)pOutput, frameCount, pDevice->playback.channels, pDevice->sampleRate);
+  }
+}
+
+static void notificationCallback(const ma_device_notification *notification) {
+  if (notification->type == ma_device_notification_type_rerouted) rerouted.store(true);
+  // the only underrun-like signal miniaudio passes on; others are found from callback timing
+  if (notification->type == ma_device_notification_type_interruption_began) {
+    interrupted.store(true);
+  }
+}
+
+ma_result initializeAudioEngine(ma_uint32 channels, ma_uint32 sampleRate) {
+  // the callback isn't running; voices of a previous device start over
+  for (Voice &voice : voices) voice.active = false;
+  framesRendered = 0;
+
+  ma_device_config config = ma_device_config_init(ma_device_type_playback);
+  // the integer mixer hands int16 to the device, saving the conversion on the way out
+  config.playback.format = integerMix.load(std::memory_order_relaxed) || s16Output
+                               ? ma_format_s16
+                               : ma_format_f32;
+  config.playback.channels = channels; // 0 = native
+  config.sampleRate = sampleRate;      // 0 = native
+  config.dataCallback = dataCallback;
+  config.notificationCallback = notificationCallback;
+
+  if (nullBackend && !nullContextReady) {
+    ma_backend backend = ma_backend_null;
+    ma_result result = ma_context_init(&backend, 1, NULL, &nullContext);
+    if (result != MA_SUCCESS) return result;
+    nullContextReady = true;
+  }
+  ma_result result = ma_device_init(nullBackend ? &nullContext : NULL, &config, &device);
+  if (result != MA_SUCCESS) return result;
+  deviceBufferNs = device.playback.internalSampleRate
+                       ? (long long)device.playback.internalPeriodSizeInFrames *
+                             device.playback.internalPeriods * 1000000000LL /
+                             device.playback.internalSampleRate
+                       : 0;
+  callbackLoad = 0.0f;
+
+  result = ma_device_start(&device);
+  if (result != MA_SUCCESS) ma_device_uninit(&device);
+  return result;
+}
+
+void uninitializeAudioEngine() { ma_device_uninit(&device); }
+
+void useNullAudioBackend() { nullBackend = true; }
+
+bool audioFormatChanged(ma_uint32 &channels, ma_uint32 &sampleRate) {
+  if (!rerouted.exchange(false)) return false;
+  channels = device.playback.internalChannels;
+  sampleRate = device.playback.internalSampleRate;
+  return channels != device.playback.channels || sampleRate != device.sampleRate;
+}
+
+void setVolume(float volume) { masterVolume.store(volume, std::memory_order_relaxed); }
+
+void setScheduledLatency(float latencyMs) {
+  scheduledLatencyNs.store((long long)(latencyMs * 1000000.0f), std::memory_order_relaxed);
+}
+
+float getVolume() { return masterVolume.load(std::memory_order_relaxed); }
+
+void setIntegerMixing(bool enabled) { integerMix.store(enabled, std::memory_order_relaxed); }
+
+bool integerMixing() { return integerMix.load(std::memory_order_relaxed); }
+
+void setS16Output(bool enabled) { s16Output = enabled; }
+
+bool audioDeviceS16() { return device.playback.format == ma_format_s16; }
+
+void setMuted(bool mute) { muted.store(mute, std::memory_order_relaxed); }
+
+bool isMuted() { return muted.load(std::memory_order_relaxed); }
+
+bool takeAudioOverrun(AudioOverrun &overrun) {
+  unsigned tail = overrunTail.load(std::memory_order_relaxed);
+  if (tail == overrunHead.load(std::memory_order_acquire)) return false;
+  overrun = overrunLog[tail & (OVERRUN_LOG_SIZE - 1)];
+  overrunTail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+void setVoiceShedding(bool enabled) { shedVoices.store(enabled, std::memory_order_relaxed); }
+
+void setPlaybackLimits(unsigned maxVoices, unsigned tailMs) {
+  voiceLimit.store(maxVoices && maxVoices < MAX_VOICES ? (int)maxVoices : MAX_VOICES,
+                   std::memory_order_relaxed);
+  tailLimitMs.store(tailMs, std::memory_order_relaxed);
+}
+
+void setSoundpackGeneration(unsigned generation) {
+  currentGeneration.store(generation, std::memory_order_release);
+}
+
+unsigned liveSoundpackGeneration() { return liveGeneration.load(std::memory_order_acquire); }
+
+void playSample(const Sample *sample, const Retrigger &retrigger, unsigned generation,
+                long long eventTimeNs) {
+  unsigned head = triggerHead.load(std::memory_order_relaxed);
+  unsigned tail = triggerTail.load(std::memory_order_acquire);
+  if (head - tail >= TRIGGER_QUEUE_SIZE) {
+    // audio thread is behind, drop
+    count(stats.triggersDropped);
+    trace(TRACE_INSTANT, "trigger dropped");
+    return;
+  }
+  count(stats.triggers);
+  trace(TRACE_INSTANT, "trigger enqueue", "queued", head - tail);
+  trace(TRACE_FLOW_START, "key press", nullptr, 0, traceFlowId(sample, eventTimeNs));
+
+  triggerQueue[head & (TRIGGER_QUEUE_SIZE - 1)] = {sample, eventTimeNs, retrigger, generation};
+  triggerHead.store(head + 1, std::memory_order_release);
+}
@@ -2,23 +2,77 @@
 #define AUDIO_H
 
 #include "miniaudio.h"
-#include <string>
-#include <unordered_map>
+#include "soundpack.h"
 
-// Global audio engine instance
-extern ma_engine engine;
+// Global playback device instance
+extern ma_device device;
 
-ma_result initializeAudioEngine();
-void playSound(const std::string &soundFile);
+// Open the playback device, in its native format unless channels/sampleRate are given
+ma_result initializeAudioEngine(ma_uint32 channels = 0, ma_uint32 sampleRate = 0);
+void uninitializeAudioEngine();
+
+// Open devices on miniaudio's null backend from now on: silent, but with real callback
+// timing, for long benchmark runs
+void useNullAudioBackend();
+
+// After the device was rerouted: whether its native format no longer matches the one
+// samples are converted to, and the new format
+bool audioFormatChanged(ma_uint32 &channels, ma_uint32 &sampleRate);
 void setVolume(float volume);
-void runMainLoop(const std::string &devicePath,
-                 const std::unordered_map<int, std::string> &keySoundMap, float volume,
-                 const std::string &soundpackPath);
-
-// Multi-device loop: keyboard + mouse
-void runMainLoopMulti(const std::string &keyboardDevicePath,
-  const std::string &mouseDevicePath,
-  const std::unordered_map<int, std::string> &keySoundMap,
-  float volume, const std::string &soundpackPath);
+float getVolume();
+void setMuted(bool mute);
+bool isMuted();
+
+// Play sounds at event time + latencyMs instead of as soon as possible (0 disables)
+void setScheduledLatency(float latencyMs);
+
+// Queue a sample for playback; eventTimeNs is the CLOCK_MONOTONIC event time (0 = now)
+void playSample(const Sample *sample, const Retrigger &retrigger, unsigned generation,
+                long long eventTimeNs);
+
+// Mix one period into `out` (zeroed, interleaved f32): the device callback's work, also
+// callable without a device by benchmarks
+void renderAudio(float *out, ma_uint32 frameCount, ma_uint32 channels, ma_uint32 sampleRate);
+
+// Same as renderAudio() with int16 output, for devices opened in ma_format_s16
+void renderAudioS16(int16_t *out, ma_uint32 frameCount, ma_uint32 channels,
+                    ma_uint32 sampleRate);
+
+// Mix with the fixed-point mixer: int16 samples summed in int32, gains in Q15, saturated to
+// int16. Cheaper on hosts with slow float, within a few LSB of the float mixer. Takes effect
+// with the next period; devices opened while it is on are opened in ma_format_s16.
+void setIntegerMixing(bool enabled);
+bool integerMixing();
+
+// Open devices in ma_format_s16 even while mixing in float, so the integer mixer can be
+// switched on later without converting every period back to f32
+void setS16Output(bool enabled);
+bool audioDeviceS16(); // the open device takes int16
+
+// A callback that ran past its period, or an underrun: the device reported an interruption
+// or a callback came later than the device buffer lasts
+struct AudioOverrun {
+  long long timeNs;    // CLOCK_MONOTONIC
+  unsigned durationUs; // callback duration; for an underrun, how late it came
+  unsigned budgetUs;   // period length
+  unsigned voices;     // playing at the time
+  bool underrun;
+};
+
+// Next overrun the audio callback logged, for reporting outside the audio thread
+bool takeAudioOverrun(AudioOverrun &overrun);
+
+// On an overrun, cap the voices below the count that overran, for 30 seconds
+void setVoiceShedding(bool enabled);
+
+// Cheaper playback for the load governor: at most maxVoices voices, each faded out after
+// tailMs (0 = no limit)
+void setPlaybackLimits(unsigned maxVoices, unsigned tailMs);
+
+// Soundpack generation triggers are queued from; older soundpacks may still be playing
+void setSoundpackGeneration(unsigned generation);
+
+// Oldest soundpack generation the mixer still references; older ones can be freed
+unsigned liveSoundpackGeneration();
 
 #endif // AUDIO_H
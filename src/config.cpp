@@ -1,3 +1,6 @@
+#include "config.h"
+#include <algorithm>
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <nlohmann/json.hpp>
@@ -6,15 +9,62 @@
 
 using json = nlohmann::json;
 
-std::unordered_map<int, std::string> loadKeySoundMappings(const std::string &configPath) {
-  std::unordered_map<int, std::string> keySoundMap;
+static RetriggerMode parseRetriggerMode(const std::string &mode) {
+  if (mode == "choke") return RETRIGGER_CHOKE;
+  if (mode == "restart") return RETRIGGER_RESTART;
+  if (mode != "stack") std::cerr << "Unknown retrigger mode: " << mode << std::endl;
+  return RETRIGGER_STACK;
+}
+
+static RepeatMode parseRepeatMode(const std::string &mode) {
+  if (mode == "throttle") return REPEAT_THROTTLE;
+  if (mode == "sample") return REPEAT_SAMPLE;
+  if (mode != "ignore") std::cerr << "Unknown repeat mode: " << mode << std::endl;
+  return REPEAT_IGNORE;
+}
+
+// A "synth" entry; fields it leaves out keep the built-in sound's values
+static SynthSound parseSynthSound(const json &soundJson) {
+  SynthSound sound = defaultSynthSound();
+  sound.pitch = std::clamp(soundJson.value("pitch", sound.pitch), 20.0f, 20000.0f);
+  sound.lengthMs = std::clamp(soundJson.value("length_ms", sound.lengthMs), 1.0f, 5000.0f);
+  sound.level = std::clamp(soundJson.value("level", sound.level), 0.0f, 1.0f);
+  if (soundJson.contains("modes")) {
+    sound.modeCount = 0;
+    for (auto &modeJson : soundJson["modes"]) {
+      if (sound.modeCount == SYNTH_MODES) {
+        std::cerr << "Synth sounds have at most " << SYNTH_MODES << " modes" << std::endl;
+        break;
+      }
+      if (!modeJson.is_array() || modeJson.size() != 3 ||
+          !std::all_of(modeJson.begin(), modeJson.end(),
+                       [](const json &value) { return value.is_number(); })) {
+        std::cerr << "Ignoring synth mode, expected [ratio, gain, decay_ms]: " << modeJson.dump()
+                  << std::endl;
+        continue;
+      }
+      sound.modeRatio[sound.modeCount] = std::clamp(modeJson[0].get<float>(), 0.01f, 100.0f);
+      sound.modeGain[sound.modeCount] = std::clamp(modeJson[1].get<float>(), -1.0f, 1.0f);
+      sound.modeDecayMs[sound.modeCount] =
+          std::clamp(modeJson[2].get<float>(), 0.1f, 5000.0f);
+      sound.modeCount++;
+    }
+  }
+  sound.noise = std::clamp(soundJson.value("noise", sound.noise), 0.0f, 4.0f);
+  sound.noiseTone = std::clamp(soundJson.value("noise_tone", sound.noiseTone), 0.0f, 1.0f);
+  sound.noiseDecayMs =
+      std::clamp(soundJson.value("noise_decay_ms", sound.noiseDecayMs), 0.1f, 1000.0f);
+  return sound;
+}
+
+bool loadSoundpackConfig(const std::string &configPath, SoundpackConfig &config) {
+  config = SoundpackConfig();
 
   std::ifstream configFile(configPath);
   if (!configFile.is_open()) {
     std::cerr << "Could not open config.json file! Is the soundpack path correct?"
               << std::endl;
-    exit(1);
-    return keySoundMap;
+    return false;
   }
 
   try {
@@ -23,16 +73,66 @@ std::unordered_map<int, std::string> loadKeySoundMappings(const std::string &con
 
     if (configJson.contains("defines")) {
       for (auto &[key, value] : configJson["defines"].items()) {
-        int keyCode = std::stoi(key);
-        if (!value.is_null()) {
-          std::string soundFile = value.get<std::string>();
-          keySoundMap[keyCode] = soundFile;
+        int keyCode;
+        auto [end, error] = std::from_chars(key.data(), key.data() + key.size(), keyCode);
+        if (error != std::errc() || end != key.data() + key.size()) {
+          std::cerr << "Ignoring define for invalid key code: " << key << std::endl;
+          continue;
         }
+        if (value.is_string()) {
+          config.keySounds[keyCode].push_back(value.get<std::string>());
+        } else if (value.is_array()) {
+          for (auto &file : value) {
+            if (file.is_string()) config.keySounds[keyCode].push_back(file.get<std::string>());
+          }
+        }
+      }
+    }
+
+    config.randomVariants = configJson.value("variant_mode", "round_robin") == "random";
+    config.variantSeed = configJson.value("variant_seed", config.variantSeed);
+    config.pitchVariants = std::clamp(configJson.value("pitch_variants", 0), 0, 16);
+    config.pitchSpread =
+        std::clamp(configJson.value("pitch_spread", config.pitchSpread), 0.0f, 0.5f);
+    config.gainSpread =
+        std::clamp(configJson.value("gain_spread", config.gainSpread), 0.0f, 1.0f);
+    config.normalize = configJson.value("normalize", config.normalize);
+
+    config.synth = configJson.value("type", "sample") == "synth";
+    config.decaySpread =
+        std::clamp(configJson.value("decay_spread", config.decaySpread), 0.0f, 1.0f);
+    if (configJson.contains("synth")) {
+      for (auto &[name, soundJson] : configJson["synth"].items()) {
+        SynthSound sound = parseSynthSound(soundJson);
+        sound.pitchSpread = config.pitchSpread;
+        sound.levelSpread = config.gainSpread;
+        sound.decaySpread = config.decaySpread;
+        config.synthSounds[name] = sound;
       }
     }
+
+    config.retrigger = parseRetriggerMode(configJson.value("retrigger", "stack"));
+    config.maxStack = std::clamp(configJson.value("max_stack", 0), 0, MAX_STACK_LIMIT);
+    config.fadeMs = std::clamp(configJson.value("fade_ms", config.fadeMs), 0.0f, 1000.0f);
+    if (configJson.contains("choke_groups")) {
+      for (auto &groupJson : configJson["choke_groups"]) {
+        ChokeGroup group;
+        group.keys = groupJson.value("keys", std::vector<int>());
+        group.retrigger = parseRetriggerMode(groupJson.value("retrigger", "choke"));
+        group.maxStack =
+            std::clamp(groupJson.value("max_stack", config.maxStack), 0, MAX_STACK_LIMIT);
+        config.chokeGroups.push_back(group);
+      }
+    }
+
+    config.repeatMode = parseRepeatMode(configJson.value("repeat_mode", "ignore"));
+    config.repeatRate =
+        std::clamp(configJson.value("repeat_rate", config.repeatRate), 0.0f, 1000.0f);
+    config.repeatSound = configJson.value("repeat_sound", "");
   } catch (json::exception &e) {
     std::cerr << "Error parsing config.json: " << e.what() << std::endl;
+    return false;
   }
 
-  return keySoundMap;
+  return true;
 }
@@ -1,10 +1,62 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "synth.h"
 #include <string>
 #include <unordered_map>
+#include <vector>
 
-// Function to load the key-sound mappings from a JSON configuration file
-std::unordered_map<int, std::string> loadKeySoundMappings(const std::string &configPath);
+#define MAX_STACK_LIMIT 8 // voices the mixer tracks per choke group
 
-#endif // CONFIG_H
\ No newline at end of file
+enum RetriggerMode : unsigned char {
+  RETRIGGER_STACK,   // let voices of a group ring on top of each other, up to max_stack
+  RETRIGGER_CHOKE,   // fade out the group's previous voice
+  RETRIGGER_RESTART, // restart the group's previous voice with the new sound
+};
+
+enum RepeatMode : unsigned char {
+  REPEAT_IGNORE,   // auto-repeat events are silent
+  REPEAT_THROTTLE, // replay the key's sound, at most repeat_rate times per second
+  REPEAT_SAMPLE,   // play repeat_sound, at most repeat_rate times per second
+};
+
+// Keys that share voices and a retrigger policy
+struct ChokeGroup {
+  std::vector<int> keys;
+  RetriggerMode retrigger;
+  int maxStack;
+};
+
+// Soundpack description parsed from config.json
+struct SoundpackConfig {
+  // keycode -> one or more sound files, picked per press
+  std::unordered_map<int, std::vector<std::string>> keySounds;
+  bool randomVariants = false; // "variant_mode": "round_robin" (default) or "random"
+  unsigned variantSeed = 1;    // "variant_seed"
+  int pitchVariants = 0;       // "pitch_variants": extra copies rendered per file at load
+  float pitchSpread = 0.03f;   // "pitch_spread": max pitch deviation of a variant (ratio)
+  float gainSpread = 0.15f;    // "gain_spread": max attenuation of a variant (ratio)
+                               // (synth packs: of every press)
+  bool normalize = true;       // "normalize": bring the pack to a common loudness at load
+
+  // "type": "synth": "defines" names sounds under "synth" instead of files; a sound named
+  // "default" plays for keys without a define
+  bool synth = false;
+  std::unordered_map<std::string, SynthSound> synthSounds;
+  float decaySpread = 0.1f; // "decay_spread": max decay deviation per press (ratio)
+
+  RetriggerMode retrigger = RETRIGGER_STACK; // "retrigger": default policy of every key
+  int maxStack = 0;                          // "max_stack": 0 = limited by the voice pool
+  float fadeMs = 10.0f;                      // "fade_ms": choke fade length
+  std::vector<ChokeGroup> chokeGroups;       // "choke_groups"
+
+  RepeatMode repeatMode = REPEAT_IGNORE; // "repeat_mode"
+  float repeatRate = 10.0f;              // "repeat_rate": Hz, 0 = every repeat event
+  std::string repeatSound;               // "repeat_sound"
+};
+
+// Function to load the soundpack description from a JSON configuration file, returns
+// false if the file could not be opened or is not valid JSON of the expected shape
+bool loadSoundpackConfig(const std::string &configPath, SoundpackConfig &config);
+
+#endif // CONFIG_H
@@ -0,0 +1,199 @@
+#include "control.h"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_REQUEST_BYTES (PATH_MAX + 64)
+
+// Line protocol: the client sends "<command> [argument]\n" and reads until EOF. Replies
+// start with "ok" or "error:".
+
+std::string controlSocketPath() {
+  const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+  if (runtimeDir && *runtimeDir) return std::string(runtimeDir) + "/wayvibes.sock";
+  return "/tmp/wayvibes-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool socketAddress(struct sockaddr_un &addr) {
+  std::string path = controlSocketPath();
+  if (path.size() >= sizeof(addr.sun_path)) return false;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+static int connectControlSocket() {
+  struct sockaddr_un addr;
+  if (!socketAddress(addr)) return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool isDaemonRunning() {
+  int fd = connectControlSocket();
+  if (fd < 0) return false;
+  close(fd);
+  return true;
+}
+
+int openControlSocket() {
+  struct sockaddr_un addr;
+  if (!socketAddress(addr)) return -1;
+
+  // Two daemons starting together would both find the socket stale and the second would
+  // unlink the first's: the check, unlink and bind happen under a lock, and the socket
+  // listens before it is released. A re-executed daemon inherits a socket that keeps
+  // listening throughout, so it needs no lock of its own.
+  std::string lockPath = std::string(addr.sun_path) + ".lock";
+  int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (lockFd < 0 || flock(lockFd, LOCK_EX) < 0) {
+    std::cerr << "Failed to lock " << lockPath << std::endl;
+    if (lockFd >= 0) close(lockFd);
+    return -1;
+  }
+
+  int fd = -1;
+  if (isDaemonRunning()) {
+    fd = CONTROL_SOCKET_IN_USE;
+  } else {
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // left behind by a daemon that did not exit cleanly; anything else at the path is kept
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(addr.sun_path);
+    if (fd >= 0 &&
+        (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0)) {
+      close(fd);
+      fd = -1;
+    }
+    if (fd < 0) std::cerr << "Failed to open control socket: " << addr.sun_path << std::endl;
+  }
+  close(lockFd); // releases the lock
+  return fd;
+}
+
+void closeControlSocket(int listenFd) {
+  if (listenFd < 0) return;
+  close(listenFd);
+  unlink(controlSocketPath().c_str());
+}
+
+bool acceptControlClient(int listenFd, ControlClient &client) {
+  // nonblocking: a client that never sends its request must not stall the input loop
+  client.fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (client.fd < 0) return false;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  client.acceptedNs = (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  client.request.clear();
+  return true;
+}
+
+int readControlRequest(ControlClient &client, std::string &command, std::string &argument) {
+  char buffer[MAX_REQUEST_BYTES];
+  bool ended = false;
+  while (client.request.find('\n') == std::string::npos &&
+         client.request.size() < MAX_REQUEST_BYTES) {
+    ssize_t n = read(client.fd, buffer, MAX_REQUEST_BYTES - client.request.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (n <= 0) {
+      ended = true; // a request without a newline is taken as it is
+      break;
+    }
+    client.request.append(buffer, n);
+  }
+  if (ended && client.request.empty()) return -1;
+
+  std::string request = client.request.substr(0, client.request.find('\n'));
+  size_t space = request.find(' ');
+  command = request.substr(0, space);
+  argument = space == std::string::npos ? "" : request.substr(space + 1);
+  return 1;
+}
+
+void sendControlReply(int clientFd, const std::string &reply) {
+  std::string line = reply + "\n";
+  size_t sent = 0;
+  while (sent < line.size()) {
+    ssize_t n = write(clientFd, line.data() + sent, line.size() - sent);
+    if (n <= 0) break;
+    sent += n;
+  }
+  close(clientFd);
+}
+
+int runControlClient(int argc, char *argv[]) {
+  if (argc < 1) {
+    std::cerr << "Usage: wayvibes ctl <command> [argument]" << std::endl;
+    return 1;
+  }
+
+  std::string request = argv[0];
+  if (request == "reexec") {
+    // the new command line, tab separated; soundpack and trace paths resolved like for
+    // `pack` and `trace`
+    for (int i = 1; i < argc; i++) {
+      std::string argument = argv[i];
+      char resolved[PATH_MAX];
+      if (std::string(argv[i - 1]) == "--trace") {
+        if (argv[i][0] != '/' && getcwd(resolved, sizeof(resolved))) {
+          argument = std::string(resolved) + "/" + argument;
+        }
+      } else if (argv[i][0] != '-' && realpath(argv[i], resolved) &&
+                 access((std::string(resolved) + "/config.json").c_str(), R_OK) == 0) {
+        argument = resolved;
+      }
+      request += (i == 1 ? " " : "\t") + argument;
+    }
+  } else if (argc > 1) {
+    std::string argument = argv[1];
+    // the daemon has its own working directory
+    char resolved[PATH_MAX];
+    if (request == "pack" && realpath(argv[1], resolved)) argument = resolved;
+    if (request == "trace" && argument != "stop" && argument[0] != '/' &&
+        getcwd(resolved, sizeof(resolved))) {
+      argument = std::string(resolved) + "/" + argument;
+    }
+    request += " " + argument;
+  }
+  request += "\n";
+
+  int fd = connectControlSocket();
+  if (fd < 0) {
+    std::cerr << "wayvibes is not running (no daemon on " << controlSocketPath() << ")"
+              << std::endl;
+    return 1;
+  }
+
+  if (write(fd, request.data(), request.size()) != (ssize_t)request.size()) {
+    std::cerr << "Failed to send request to wayvibes." << std::endl;
+    close(fd);
+    return 1;
+  }
+  shutdown(fd, SHUT_WR);
+
+  std::string reply;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) reply.append(buffer, n);
+  close(fd);
+
+  std::cout << reply << std::flush;
+  return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
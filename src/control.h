@@ -0,0 +1,39 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <string>
+
+// Path of the daemon's control socket: $XDG_RUNTIME_DIR/wayvibes.sock
+std::string controlSocketPath();
+
+// Whether a wayvibes daemon is answering on the control socket
+bool isDaemonRunning();
+
+// Bind the control socket, replacing a stale one; returns the listening fd, -1 on error or
+// CONTROL_SOCKET_IN_USE if another daemon answers on it
+#define CONTROL_SOCKET_IN_USE -2
+int openControlSocket();
+void closeControlSocket(int listenFd);
+
+// A connected client whose request line may not have arrived yet
+struct ControlClient {
+  int fd;
+  long long acceptedNs; // CLOCK_MONOTONIC
+  std::string request;  // received so far
+};
+
+// Accept one client without waiting for its request; false if none is waiting
+bool acceptControlClient(int listenFd, ControlClient &client);
+
+// Read what the client sent since the last call, never blocking. 1 once its request line is
+// complete (parsed into command and argument), 0 if more is to come, -1 if it hung up first.
+int readControlRequest(ControlClient &client, std::string &command, std::string &argument);
+
+// Send the reply and close the client connection
+void sendControlReply(int clientFd, const std::string &reply);
+
+// `wayvibes ctl <command> [argument]`: send one request to the running daemon and print
+// its reply, returns the process exit code
+int runControlClient(int argc, char *argv[]);
+
+#endif // CONTROL_H
@@ -0,0 +1,625 @@
+#include "daemon.h"
+#include "alloctrack.h"
+#include "audio.h"
+#include "control.h"
+#include "device.h"
+#include "eventsource.h"
+#include "governor.h"
+#include "handoff.h"
+#include "inputring.h"
+#include "metrics.h"
+#include "samplebank.h"
+#include "stats.h"
+#include "status.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <linux/input.h>
+#include <poll.h>
+#include <sstream>
+#include <time.h>
+#include <unistd.h>
+
+#define EVENT_BATCH 64
+#define OVERRUN_WARNING_INTERVAL_NS 5000000000LL
+#define LOAD_WARNING_PERMILLE 800
+#define LOAD_WARNING_INTERVAL_NS 60000000000LL
+#define CONTROL_CLIENTS 8                      // waiting for their request at once
+#define CONTROL_CLIENT_TIMEOUT_NS 1000000000LL // to send it
+#define CONTROL_CLIENT_WAIT_MS 5               // poll timeout while one is waiting
+
+// Input devices first, then the control socket
+static std::vector<struct pollfd> fds;
+static size_t deviceCount = 0;
+static std::vector<EventSource> sources; // parallel to the device fds
+static int controlFd = -1;
+static std::vector<ControlClient> controlClients; // connected, request not complete yet
+static bool ioUringRequested = false;
+static bool ringActive = false; // devices and control socket are read through inputring.h
+static std::string injectSocketPath;
+static std::string injectFifoPath;
+
+static Soundpack *soundpack = nullptr;
+static std::vector<Soundpack *> retired; // replaced, possibly still playing
+
+// Device format soundpacks are converted to; follows the device when it is rerouted
+static ma_uint32 loadChannels = 0;
+static ma_uint32 loadSampleRate = 0;
+static bool reconvertPending = false;
+
+static long long dedupWindowNs = 5000000;
+static long long lastPressNs[KEY_CNT];
+static unsigned char lastPressSource[KEY_CNT];
+
+static volatile sig_atomic_t statsRequested = 0;
+static volatile sig_atomic_t reloadRequested = 0;
+static volatile sig_atomic_t quitRequested = 0;
+
+void setDedupWindow(float windowMs) { dedupWindowNs = (long long)(windowMs * 1000000.0f); }
+
+void setIoUringInput(bool enabled) { ioUringRequested = enabled; }
+
+void setInjectSocket(const std::string &path) { injectSocketPath = path; }
+
+void setInjectFifo(const std::string &path) { injectFifoPath = path; }
+
+static void requestStats(int) { statsRequested = 1; }
+
+static void requestReload(int) { reloadRequested = 1; }
+
+static void requestQuit(int) { quitRequested = 1; }
+
+static const char *sampleFormatName(SampleFormat format) {
+  return format == SAMPLE_F32    ? "f32"
+         : format == SAMPLE_S16  ? "s16"
+         : format == SAMPLE_ULAW ? "ulaw"
+                                 : "synth";
+}
+
+static void publishSampleBank() {
+  size_t referenced, stored;
+  sampleBankUsage(referenced, stored);
+  stats.bankReferencedBytes.store(referenced, std::memory_order_relaxed);
+  stats.bankStoredBytes.store(stored, std::memory_order_relaxed);
+}
+
+// Report what the soundpack's sample storage costs against plain f32
+static void publishSampleMemory() {
+  size_t stored, expanded;
+  sampleMemory(*soundpack, device.playback.channels, stored, expanded);
+  stats.sampleBytes.store(stored, std::memory_order_relaxed);
+  stats.sampleBytesF32.store(expanded, std::memory_order_relaxed);
+  std::ostringstream gainDb;
+  gainDb << std::showpos << std::fixed << std::setprecision(1)
+         << 20.0f * std::log10(soundpack->gain);
+  std::cout << "Sample memory: " << stored / 1024 << " KiB as "
+            << sampleFormatName(soundpack->sampleFormat) << " (" << expanded / 1024
+            << " KiB as f32), normalized by " << gainDb.str() << " dB" << std::endl;
+  publishSampleBank();
+}
+
+// Reopen the playback device in the format a soundpack was converted to
+static void reopenAudioDevice(ma_uint32 channels, ma_uint32 sampleRate) {
+  uninitializeAudioEngine();
+  if (initializeAudioEngine(channels, sampleRate) == MA_SUCCESS) {
+    std::cout << "Audio device reopened at " << channels << " channels, " << sampleRate
+              << " Hz" << std::endl;
+  } else if (initializeAudioEngine() != MA_SUCCESS) {
+    std::cerr << "Failed to reopen audio device" << std::endl;
+  }
+}
+
+// Switch the input loop to a freshly loaded soundpack; the old one is kept in `retired`
+// until the mixer reports it no longer plays any of its samples
+static void adoptSoundpack(Soundpack *next) {
+  if (next->channels != device.playback.channels || next->sampleRate != device.sampleRate) {
+    reopenAudioDevice(next->channels, next->sampleRate);
+  }
+  retired.push_back(soundpack);
+  soundpack = next;
+  setSoundpackGeneration(next->generation);
+  count(stats.reloads);
+  std::cout << "Soundpack reloaded: " << next->path << std::endl;
+  publishSampleMemory();
+}
+
+static void freeRetiredSoundpacks() {
+  unsigned live = liveSoundpackGeneration();
+  bool freed = false;
+  for (size_t i = 0; i < retired.size();) {
+    if (retired[i]->generation < live) {
+      delete retired[i]; // drops its references into the sample bank
+      retired[i] = retired.back();
+      retired.pop_back();
+      freed = true;
+    } else {
+      i++;
+    }
+  }
+  if (freed) publishSampleBank();
+}
+
+static long long eventTimeNs(const struct input_event &ev) {
+  return (long long)ev.input_event_sec * 1000000000LL + ev.input_event_usec * 1000LL;
+}
+
+static long long monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void closeInputDevices() {
+  if (ringActive) closeInputRing();
+  ringActive = false;
+  for (EventSource &source : sources) closeEventSource(source);
+  fds.clear();
+  sources.clear();
+  deviceCount = 0;
+}
+
+// Move the current device set onto an io_uring if one was asked for
+static void attachInputRing() {
+  if (!ioUringRequested) return;
+  std::vector<int> deviceFds;
+  std::vector<bool> polled;
+  for (size_t i = 0; i < deviceCount; i++) {
+    deviceFds.push_back(fds[i].fd);
+    polled.push_back(!sources[i].ops->ringReads);
+  }
+  ringActive = openInputRing(deviceFds, polled, controlFd);
+  static bool reported = false;
+  if (!reported) {
+    std::cout << (ringActive ? "Reading input through io_uring"
+                             : "io_uring multishot reads unavailable, reading input with poll")
+              << std::endl;
+    reported = true;
+  }
+}
+
+static void addEventSource(const EventSource &source) {
+  fds.push_back({source.fd, POLLIN, 0});
+  sources.push_back(source);
+}
+
+// Publish the source set once deviceCount is known, keeping the control socket last in the
+// poll set
+static void finishInputDevices() {
+  deviceCount = fds.size();
+  if (controlFd >= 0) fds.push_back({controlFd, POLLIN, 0});
+  std::vector<std::string> paths;
+  for (const EventSource &source : sources) paths.push_back(source.path);
+  setMetricsDevices(paths);
+  attachInputRing();
+}
+
+// Open one device or injector; `what` names it in messages
+static void openSource(const EventSourceOps &ops, const std::string &path, const char *what,
+                       const char *events) {
+  EventSource source;
+  if (!openEventSource(ops, path, source)) {
+    std::cerr << "Failed to open " << what << ": " << path << std::endl;
+  } else {
+    std::cout << "Listening for " << events << " on: " << path << std::endl;
+    addEventSource(source);
+  }
+}
+
+// (Re)open the input devices, then the injectors
+static void openInputDevices(const std::vector<std::string> &keyboardDevicePaths,
+                             const std::string &mouseDevicePath) {
+  closeInputDevices();
+
+  for (const std::string &keyboardDevicePath : keyboardDevicePaths) {
+    openSource(evdevSource, keyboardDevicePath, "keyboard device", "key events");
+  }
+  if (!mouseDevicePath.empty()) {
+    openSource(evdevSource, mouseDevicePath, "mouse device", "mouse events");
+  }
+  if (!injectSocketPath.empty()) {
+    openSource(injectSocketSource, injectSocketPath, "inject socket", "injected events");
+  }
+  if (!injectFifoPath.empty()) {
+    openSource(injectFifoSource, injectFifoPath, "inject FIFO", "injected events");
+  }
+  finishInputDevices();
+}
+
+void adoptInputDevices(const Handoff &handoff) {
+  closeInputDevices();
+  for (size_t i = 0; i < handoff.deviceFds.size(); i++) {
+    std::cout << "Listening for events on: " << handoff.devicePaths[i] << " (inherited)"
+              << std::endl;
+    addEventSource(adoptEventSource(handoff.deviceFds[i], handoff.devicePaths[i]));
+  }
+  controlFd = handoff.controlFd;
+  finishInputDevices();
+}
+
+// Drop a press another device already reported within the window: keyd and other
+// remappers re-emit every key on a virtual device
+static bool isDuplicatePress(unsigned keyCode, int source, long long timeNs) {
+  if (keyCode >= KEY_CNT) return false;
+  if (lastPressSource[keyCode] != source && timeNs - lastPressNs[keyCode] < dedupWindowNs) {
+    return true;
+  }
+  lastPressNs[keyCode] = timeNs;
+  lastPressSource[keyCode] = source;
+  return false;
+}
+
+// An injector's event time, or now if it has none or one that can't be right: from the future
+// or another clock, or older than INJECT_TIME_WINDOW_NS. With --latency such a time would
+// park a voice for hours.
+static long long injectedTimeNs(const struct input_event &ev, long long nowNs) {
+  // range-checked first, the conversion of a bogus time could overflow
+  long long sec = ev.input_event_sec, usec = ev.input_event_usec;
+  if (sec < 0 || sec > nowNs / 1000000000LL || usec < 0 || usec >= 1000000) return nowNs;
+  long long timeNs = eventTimeNs(ev);
+  return timeNs > nowNs || timeNs < nowNs - INJECT_TIME_WINDOW_NS ? nowNs : timeNs;
+}
+
+static void dispatchInputEvents(size_t source, const struct input_event *events,
+                                size_t eventCount) {
+  ALLOC_STAGE(ALLOC_STAGE_INPUT);
+  count(stats.eventsRead, eventCount);
+  long long nowNs = 0;
+  bool injected = sources[source].ops->injected;
+  if (source < STATS_DEVICES) count(stats.deviceEvents[source], eventCount);
+  for (size_t e = 0; e < eventCount; e++) {
+    const struct input_event &ev = events[e];
+    if (ev.type != EV_KEY || ev.value == 0) continue;
+
+    // Key or mouse button press, or auto-repeat
+    long long timeNs;
+    if (injected) {
+      if (nowNs == 0) nowNs = monotonicNs();
+      timeNs = injectedTimeNs(ev, nowNs);
+    } else {
+      timeNs = eventTimeNs(ev);
+    }
+    if (ev.value == 1 && isDuplicatePress(ev.code, (int)source, timeNs)) {
+      count(stats.duplicatesDropped);
+      continue;
+    }
+    trace(TRACE_BEGIN, "dispatch", "key", ev.code);
+    const Sample *sample = pickSample(*soundpack, ev.code, ev.value, timeNs);
+    if (sample) {
+      playSample(sample, soundpack->keys[ev.code].retrigger, soundpack->generation, timeNs);
+    }
+    trace(TRACE_END, "dispatch");
+  }
+}
+
+static void readInputEvents(size_t source) {
+  ALLOC_STAGE(ALLOC_STAGE_INPUT);
+  trace(TRACE_BEGIN, "read batch");
+  struct input_event events[EVENT_BATCH];
+  size_t eventCount = readEventSource(sources[source], events, EVENT_BATCH);
+  dispatchInputEvents(source, events, eventCount);
+  trace(TRACE_END, "read batch", "events", (long long)eventCount);
+}
+
+static void closeDisconnectedDevice(size_t source) {
+  // device went away; stop polling it instead of spinning on the error
+  std::cerr << "Input device disconnected." << std::endl;
+  if (ringActive) removeInputRingDevice(source);
+  closeEventSource(sources[source]);
+  fds[source].fd = -1;
+}
+
+// Dispatch the completions waitInputRing() found; true if a control client is waiting
+static bool harvestInputRing() {
+  bool controlReady = false;
+  InputRingEntry entry;
+  while (takeInputRingEntry(entry)) {
+    if (entry.kind == INPUT_RING_EVENTS) {
+      trace(TRACE_BEGIN, "read batch");
+      dispatchInputEvents(entry.source, entry.events, entry.count);
+      trace(TRACE_END, "read batch", "events", (long long)entry.count);
+    } else if (entry.kind == INPUT_RING_READY) {
+      readInputEvents(entry.source);
+    } else if (entry.kind == INPUT_RING_CLOSED) {
+      closeDisconnectedDevice(entry.source);
+    } else {
+      controlReady = true;
+    }
+  }
+  return controlReady;
+}
+
+// Warn about audio callbacks that overran their period or underran the device, and about
+// a callback load close to the period; at most one line every few seconds
+static void reportAudioOverruns() {
+  static long long lastWarningNs = 0;
+  static unsigned long suppressed = 0;
+  long long nowNs = monotonicNs();
+
+  AudioOverrun overrun, last = {};
+  unsigned long logged = 0;
+  while (takeAudioOverrun(overrun)) {
+    last = overrun;
+    logged++;
+  }
+  if (logged) {
+    if (nowNs - lastWarningNs < OVERRUN_WARNING_INTERVAL_NS) {
+      suppressed += logged;
+      return;
+    }
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    if (last.underrun) {
+      line << "Audio underrun: the callback came " << last.durationUs / 1000.0
+           << " ms late";
+    } else {
+      line << "Audio callback overran its period: " << last.durationUs / 1000.0 << " of "
+           << last.budgetUs / 1000.0 << " ms";
+    }
+    line << ", " << last.voices << " voices playing";
+    if (suppressed + logged > 1) line << " (" << suppressed + logged - 1 << " more)";
+    std::cerr << line.str() << std::endl;
+    lastWarningNs = nowNs;
+    suppressed = 0;
+    return;
+  }
+
+  static long long lastLoadWarningNs = -LOAD_WARNING_INTERVAL_NS;
+  unsigned long load = stats.callbackLoadPermille.load(std::memory_order_relaxed);
+  if (load >= LOAD_WARNING_PERMILLE && nowNs - lastLoadWarningNs >= LOAD_WARNING_INTERVAL_NS) {
+    std::cerr << "Audio callback uses " << load / 10 << "% of its period; a larger audio "
+              << "buffer or fewer voices (--shed-voices) would avoid crackles" << std::endl;
+    lastLoadWarningNs = nowNs;
+  }
+}
+
+static std::string startReload(const std::string &soundpackPath) {
+  if (access((soundpackPath + "/config.json").c_str(), R_OK) != 0) {
+    return "error: no config.json in " + soundpackPath;
+  }
+  if (!reloadSoundpackAsync(soundpackPath, loadChannels, loadSampleRate)) {
+    return "error: reload already in progress";
+  }
+  return "ok loading " + soundpackPath;
+}
+
+static std::string handleControlRequest(std::string &configDir, const std::string &command,
+                                        const std::string &argument) {
+  std::ostringstream reply;
+  reply << std::fixed << std::setprecision(2);
+
+  if (command == "ping") {
+    reply << "ok";
+  } else if (command == "volume") {
+    if (!argument.empty()) {
+      float volume = NAN;
+      try {
+        volume = std::stof(argument);
+      } catch (...) {
+      }
+      // stof takes "nan" and "inf", which clamp lets through
+      if (!std::isfinite(volume)) return "error: invalid volume " + argument;
+      setVolume(std::clamp(volume, 0.0f, 10.0f));
+    }
+    reply << "ok volume " << getVolume();
+  } else if (command == "mute" || command == "unmute" || command == "toggle-mute") {
+    setMuted(command == "toggle-mute" ? !isMuted() : command == "mute");
+    reply << (isMuted() ? "ok muted" : "ok unmuted");
+  } else if (command == "pack") {
+    if (argument.empty()) return "ok pack " + soundpack->path;
+    return startReload(argument);
+  } else if (command == "reload") {
+    return startReload(soundpack->path);
+  } else if (command == "rescan") {
+    invalidateDeviceScan();
+    openInputDevices(getInputDevicePaths(configDir), getMouseDevicePath(configDir));
+    reply << "ok " << deviceCount << " devices";
+  } else if (command == "reexec") {
+    reply << "ok re-executing"; // done by the loop once the reply is sent
+  } else if (command == "status") {
+    reply << "ok\npack: " << soundpack->path << "\nvolume: " << getVolume()
+          << "\nmuted: " << (isMuted() ? "yes" : "no") << "\ndevices: " << deviceCount;
+  } else if (command == "stats") {
+    reply << "ok\n";
+    printStats(reply);
+  } else if (command == "trace") {
+    if (argument == "stop") {
+      std::string path = stopTrace();
+      if (path.empty()) return "error: not tracing";
+      reply << "ok trace written to " << path;
+    } else if (!argument.empty()) {
+      if (!startTrace(argument)) return "error: already tracing or cannot write " + argument;
+      reply << "ok tracing to " << argument;
+    } else {
+      reply << (traceEnabled.load() ? "ok tracing" : "ok not tracing");
+    }
+  } else if (command == "allocs") {
+#ifdef WAYVIBES_ALLOC_TRACKING
+    reply << "ok\n";
+    printAllocationReport(reply);
+#else
+    reply << "error: built without allocation tracking (make ALLOC_TRACKING=1)";
+#endif
+  } else {
+    reply << "error: unknown command " << command;
+  }
+
+  std::string text = reply.str();
+  if (!text.empty() && text.back() == '\n') text.pop_back();
+  return text;
+}
+
+// Arguments this process was started with
+static std::vector<std::string> commandLine() {
+  std::vector<std::string> args;
+  std::ifstream cmdline("/proc/self/cmdline");
+  std::string arg;
+  while (std::getline(cmdline, arg, '\0')) args.push_back(arg);
+  return args;
+}
+
+// Replace this process with a fresh wayvibes that inherits the decoded soundpack, the input
+// devices and the control socket; `argument` is the new command line, tab separated
+// (empty = the current one). Returns only if the exec failed.
+static void reexecDaemon(const std::string &argument) {
+  std::vector<std::string> args = commandLine();
+  if (args.empty()) args.push_back("wayvibes");
+  if (!argument.empty()) {
+    args.resize(1);
+    std::istringstream fields(argument);
+    std::string field;
+    while (std::getline(fields, field, '\t')) args.push_back(field);
+  }
+
+  Handoff handoff;
+  handoff.soundpack = soundpack;
+  handoff.controlFd = controlFd;
+  for (size_t i = 0; i < deviceCount; i++) {
+    if (fds[i].fd < 0) continue;
+    handoff.deviceFds.push_back(fds[i].fd);
+    handoff.devicePaths.push_back(sources[i].path);
+  }
+
+  std::cout << "Re-executing, handing over the soundpack and " << handoff.deviceFds.size()
+            << " devices." << std::endl;
+  stopTrace(); // closed so the file is complete; the new command line may trace again
+  uninitializeAudioEngine(); // the new process opens the audio device itself
+  reexecWithHandoff(args, handoff);
+
+  if (initializeAudioEngine(soundpack->channels, soundpack->sampleRate) != MA_SUCCESS) {
+    std::cerr << "Failed to reinitialize audio engine" << std::endl;
+    quitRequested = 1;
+  }
+}
+
+// Answer the clients whose request is complete, without waiting for the others; those that
+// hang up or take too long are dropped
+static void serveControlClients(std::string &configDir) {
+  long long nowNs = monotonicNs();
+  for (size_t i = 0; i < controlClients.size();) {
+    ControlClient &client = controlClients[i];
+    std::string command, argument;
+    int ready = readControlRequest(client, command, argument);
+    if (ready == 0 && nowNs - client.acceptedNs < CONTROL_CLIENT_TIMEOUT_NS) {
+      i++;
+      continue;
+    }
+    int clientFd = client.fd;
+    controlClients.erase(controlClients.begin() + i);
+    if (ready <= 0) {
+      close(clientFd);
+      continue;
+    }
+    sendControlReply(clientFd, handleControlRequest(configDir, command, argument));
+    if (command == "reexec") reexecDaemon(argument);
+  }
+}
+
+void runMainLoopMulti(std::string &configDir,
+                      const std::vector<std::string> &keyboardDevicePaths,
+                      const std::string &mouseDevicePath, Soundpack *initialSoundpack,
+                      float volume) {
+  soundpack = initialSoundpack;
+  loadChannels = device.playback.channels;
+  loadSampleRate = device.sampleRate;
+  if (controlFd < 0) controlFd = openControlSocket();
+  if (controlFd == CONTROL_SOCKET_IN_USE) {
+    std::cerr << "wayvibes is already running. Use 'wayvibes ctl <command>' to control it."
+              << std::endl;
+    return;
+  }
+  openStatusPage();
+  if (deviceCount == 0) openInputDevices(keyboardDevicePaths, mouseDevicePath);
+
+  if (deviceCount == 0) {
+    std::cerr << "No input devices available to listen on." << std::endl;
+    closeControlSocket(controlFd);
+    closeStatusPage();
+    return;
+  }
+
+  setVolume(volume);
+  setSoundpackGeneration(soundpack->generation);
+  publishSampleMemory();
+  signal(SIGUSR1, requestStats);
+  signal(SIGHUP, requestReload);
+  signal(SIGPIPE, SIG_IGN); // clients may hang up before reading their reply
+  signal(SIGINT, requestQuit);
+  signal(SIGTERM, requestQuit);
+
+  while (!quitRequested) {
+    // 50ms timeout; clients that haven't sent their request yet are read again soon
+    int timeout = controlClients.empty() ? 50 : CONTROL_CLIENT_WAIT_MS;
+    int ret = ringActive ? waitInputRing(timeout) : poll(fds.data(), fds.size(), timeout);
+
+    if (statsRequested) {
+      statsRequested = 0;
+      printStats(std::cerr);
+    }
+
+    if (reloadRequested) {
+      reloadRequested = 0;
+      std::string result = startReload(soundpack->path);
+      if (result.compare(0, 2, "ok") != 0) std::cerr << result << std::endl;
+    }
+
+    ma_uint32 channels, sampleRate;
+    if (audioFormatChanged(channels, sampleRate)) {
+      std::cout << "Audio device format changed to " << channels << " channels, " << sampleRate
+                << " Hz, reconverting samples" << std::endl;
+      loadChannels = channels;
+      loadSampleRate = sampleRate;
+      reconvertPending = true;
+    }
+    // retried until no other reload is in the way
+    if (reconvertPending && startReload(soundpack->path).compare(0, 2, "ok") == 0) {
+      reconvertPending = false;
+    }
+
+    reportAudioOverruns();
+    updateGovernor(monotonicNs());
+    if (Soundpack *next = takePendingSoundpack()) adoptSoundpack(next);
+    if (!retired.empty()) freeRetiredSoundpacks();
+    updateStatusPage(soundpack->path, getVolume(), isMuted());
+    if (!controlClients.empty()) serveControlClients(configDir);
+
+    if (ret <= 0) continue;
+    trace(TRACE_INSTANT, "poll wakeup", "ready", ret);
+
+    bool controlReady;
+    if (ringActive) {
+      controlReady = harvestInputRing();
+    } else {
+      for (size_t i = 0; i < deviceCount; ++i) {
+        if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+          closeDisconnectedDevice(i);
+          continue;
+        }
+        if (fds[i].revents & POLLIN) readInputEvents(i);
+      }
+      controlReady = controlFd >= 0 && (fds.back().revents & POLLIN);
+    }
+
+    if (controlReady) {
+      ControlClient client;
+      while (acceptControlClient(controlFd, client)) {
+        if (controlClients.size() < CONTROL_CLIENTS) {
+          controlClients.push_back(client);
+        } else {
+          close(client.fd);
+        }
+      }
+      serveControlClients(configDir);
+    }
+  }
+  for (ControlClient &client : controlClients) close(client.fd);
+  controlClients.clear();
+
+  // remove the socket and status page so clients see wayvibes is gone
+  closeInputDevices();
+  closeControlSocket(controlFd);
+  closeStatusPage();
+}
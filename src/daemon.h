@@ -0,0 +1,33 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "handoff.h"
+#include "soundpack.h"
+#include <string>
+#include <vector>
+
+// Drop a key press repeated by another input device within windowMs (0 disables)
+void setDedupWindow(float windowMs);
+
+// Read the input devices through io_uring (see inputring.h), falling back to poll()
+void setIoUringInput(bool enabled);
+
+// Also take packed input_event records from local programs through a Unix datagram socket
+// or a FIFO at this path (see eventsource.h); reopened with the devices on rescan
+void setInjectSocket(const std::string &path);
+void setInjectFifo(const std::string &path);
+
+// Listen on the devices and control socket inherited from a re-exec; runMainLoopMulti()
+// then skips opening its own
+void adoptInputDevices(const Handoff &handoff);
+
+// Resident loop: plays the soundpack for the keyboards + mouse and serves `wayvibes ctl`
+// requests. Takes ownership of the soundpack; SIGHUP or `ctl reload` reloads it in the
+// background and swaps it in without interrupting playback, `ctl reexec` replaces the
+// process while keeping the decoded samples and open devices.
+void runMainLoopMulti(std::string &configDir,
+                      const std::vector<std::string> &keyboardDevicePaths,
+                      const std::string &mouseDevicePath, Soundpack *soundpack,
+                      float volume);
+
+#endif // DAEMON_H
@@ -1,16 +1,21 @@
 #include "device.h"
+#include <algorithm>
 #include <cstring>
 #include <dirent.h>
-#include <fcntl.h>
-#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <libevdev-1.0/libevdev/libevdev.h>
+#include <climits>
+#include <linux/input.h>
+#include <nlohmann/json.hpp>
 #include <string>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #define deviceDir "/dev/input/"
+#define sysInputDir "/sys/class/input/"
+#define byIdDir "/dev/input/by-id/"
+#define byPathDir "/dev/input/by-path/"
 // ANSI color codes for terminal styling
 #define RESET "\033[0m"
 #define BOLD "\033[1m"
@@ -20,70 +25,165 @@
 #define BLUE "\033[34m"
 #define CYAN "\033[36m"
 
-std::string findKeyboardDevices() {
-  DIR *dir = opendir(deviceDir);
-  if (!dir) {
-    std::cerr << RED << "Failed to open /dev/input directory" << RESET << std::endl;
-    return "";
+// Read a sysfs attribute of an input class device, e.g. "device/name"
+static std::string readSysAttribute(const std::string &node, const std::string &attribute) {
+  std::ifstream file(sysInputDir + node + "/" + attribute);
+  std::string value;
+  std::getline(file, value);
+  return value;
+}
+
+// Parse a sysfs capability bitmap: hex words, most significant first
+static std::vector<unsigned long> readCapabilities(const std::string &node,
+                                                  const std::string &type) {
+  std::ifstream file(sysInputDir + node + "/device/capabilities/" + type);
+  std::vector<unsigned long> words;
+  std::string word;
+  while (file >> word) {
+    words.insert(words.begin(), std::stoul(word, nullptr, 16));
   }
+  return words;
+}
 
-  std::vector<std::string> devices;
-  struct dirent *entry;
+static bool testBit(const std::vector<unsigned long> &bits, unsigned bit) {
+  const unsigned wordBits = sizeof(unsigned long) * 8;
+  return bit / wordBits < bits.size() && (bits[bit / wordBits] >> (bit % wordBits)) & 1;
+}
+
+static unsigned readSysHex(const std::string &node, const std::string &attribute) {
+  std::string value = readSysAttribute(node, attribute);
+  return value.empty() ? 0 : (unsigned)std::stoul(value, nullptr, 16);
+}
+
+// Map event node -> symlink for every link in a /dev/input/by-* directory, one readdir
+static std::unordered_map<std::string, std::string> scanDeviceLinks(const char *linkDir) {
+  std::unordered_map<std::string, std::string> links;
+  DIR *dir = opendir(linkDir);
+  if (!dir) return links;
 
+  struct dirent *entry;
+  char target[PATH_MAX];
   while ((entry = readdir(dir)) != NULL) {
-    // if (!strstr(entry->d_name, "mouse")) {
-    if (strncmp(entry->d_name, "event", 5) == 0) {
-      devices.push_back(entry->d_name);
-    }
+    std::string linkPath = std::string(linkDir) + entry->d_name;
+    ssize_t len = readlink(linkPath.c_str(), target, sizeof(target) - 1);
+    if (len <= 0) continue;
+    target[len] = '\0';
+
+    const char *node = strrchr(target, '/');
+    node = node ? node + 1 : target;
+    if (strncmp(node, "event", 5) == 0) links.emplace(node, linkPath);
   }
 
   closedir(dir);
+  return links;
+}
 
-  if (devices.empty()) {
-    std::cerr << RED << "No input devices found!" << RESET << std::endl;
-    return "";
-  }
+// Result of the last sysfs scan, and identity key -> indices into it
+static std::vector<InputDeviceInfo> devices;
+static std::unordered_map<std::string, std::vector<size_t>> identityIndex;
+static bool scanned = false;
 
-  std::vector<std::string> filteredDevices;
+void invalidateDeviceScan() {
+  devices.clear();
+  identityIndex.clear();
+  scanned = false;
+}
 
-  std::cout << CYAN << "Available Keyboard devices:" << RESET << std::endl;
+// Classify every event node from sysfs in one pass, without opening any of them
+static const std::vector<InputDeviceInfo> &scanInputDevices() {
+  if (scanned) return devices;
+  scanned = true;
 
-  for (size_t i = 0, displayIndex = 1; i < devices.size(); ++i) {
-    std::string devicePath = deviceDir + devices[i];
-    struct libevdev *dev = nullptr;
-    int fd = open(devicePath.c_str(), O_RDONLY);
-    if (fd < 0) {
-      std::cerr << RED << "Error opening " << devicePath << RESET << std::endl;
-      continue;
-    }
+  DIR *dir = opendir(sysInputDir);
+  if (!dir) {
+    std::cerr << RED << "Failed to open " << sysInputDir << " directory" << RESET
+              << std::endl;
+    return devices;
+  }
 
-    int rc = libevdev_new_from_fd(fd, &dev);
-    if (rc < 0) {
-      std::cerr << RED << "Failed to create evdev device for " << devicePath << RESET
-                << std::endl;
-      close(fd);
-      continue;
-    }
+  std::unordered_map<std::string, std::string> byId = scanDeviceLinks(byIdDir);
+  std::unordered_map<std::string, std::string> byPath = scanDeviceLinks(byPathDir);
 
-    if (libevdev_has_event_code(dev, EV_KEY, KEY_A)) {
-      std::cout << CYAN << BOLD << displayIndex << ". " << RESET << YELLOW
-                << libevdev_get_name(dev) << RESET << " (" << devices[i] << ")"
-                << std::endl;
-      filteredDevices.push_back(devices[i]);
-      displayIndex++;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "event", 5) != 0) continue;
+
+    InputDeviceInfo device;
+    device.node = entry->d_name;
+    device.kinds = 0;
+
+    DeviceIdentity &identity = device.identity;
+    identity.bus = readSysHex(device.node, "device/id/bustype");
+    identity.vendor = readSysHex(device.node, "device/id/vendor");
+    identity.product = readSysHex(device.node, "device/id/product");
+    identity.version = readSysHex(device.node, "device/id/version");
+    identity.name = readSysAttribute(device.node, "device/name");
+    identity.phys = readSysAttribute(device.node, "device/phys");
+    identity.uniq = readSysAttribute(device.node, "device/uniq");
+    if (byPath.count(device.node)) identity.byPath = byPath[device.node];
+    if (byId.count(device.node)) device.byId = byId[device.node];
+
+    std::vector<unsigned long> key = readCapabilities(device.node, "key");
+    std::vector<unsigned long> rel = readCapabilities(device.node, "rel");
+    std::vector<unsigned long> abs = readCapabilities(device.node, "abs");
+
+    if (testBit(key, KEY_A)) device.kinds |= DEVICE_KEYBOARD;
+    if (testBit(rel, REL_X) || (testBit(key, BTN_LEFT) && !testBit(abs, ABS_X))) {
+      device.kinds |= DEVICE_MOUSE;
     }
+    if (testBit(abs, ABS_X) && testBit(key, BTN_TOOL_FINGER)) device.kinds |= DEVICE_TOUCHPAD;
+    if (testBit(rel, REL_WHEEL) && !testBit(rel, REL_X)) device.kinds |= DEVICE_WHEEL;
+
+    if (device.kinds) devices.push_back(device);
+  }
+
+  closedir(dir);
 
-    libevdev_free(dev);
-    close(fd);
+  // eventN in numeric order, like the kernel registered them
+  std::sort(devices.begin(), devices.end(),
+            [](const InputDeviceInfo &a, const InputDeviceInfo &b) {
+              return std::stoi(a.node.substr(5)) < std::stoi(b.node.substr(5));
+            });
+  return devices;
+}
+
+static std::string deviceKindLabel(unsigned kinds) {
+  std::string label;
+  if (kinds & DEVICE_KEYBOARD) label += "keyboard, ";
+  if (kinds & DEVICE_MOUSE) label += "mouse, ";
+  if (kinds & DEVICE_TOUCHPAD) label += "touchpad, ";
+  if (kinds & DEVICE_WHEEL) label += "wheel, ";
+  return label.substr(0, label.size() - 2);
+}
+
+// List devices of the given kinds and let the user pick one, returns its event node
+static std::string selectDevice(unsigned kinds, const std::string &kindName) {
+  const std::vector<InputDeviceInfo> &devices = scanInputDevices();
+  std::vector<std::string> filteredDevices;
+
+  std::cout << CYAN << "Available " << kindName << " devices:" << RESET << std::endl;
+
+  for (size_t i = 0, displayIndex = 1; i < devices.size(); ++i) {
+    if (!(devices[i].kinds & kinds)) continue;
+    std::cout << CYAN << BOLD << displayIndex << ". " << RESET << YELLOW << devices[i].identity.name
+              << RESET << " (" << devices[i].node << ", "
+              << deviceKindLabel(devices[i].kinds) << ")" << std::endl;
+    filteredDevices.push_back(devices[i].node);
+    displayIndex++;
   }
 
+  std::string lowerKindName = kindName;
+  lowerKindName[0] = tolower(lowerKindName[0]);
+
   if (filteredDevices.empty()) {
-    std::cerr << RED << "No suitable keyboard input devices found!" << RESET << std::endl;
+    std::cerr << RED << "No suitable " << lowerKindName << " input devices found!" << RESET
+              << std::endl;
     return "";
   }
 
   if (filteredDevices.size() == 1) {
-    std::cout << CYAN << "Selecting this keyboard device." << RESET << std::endl;
+    std::cout << CYAN << "Selecting this " << lowerKindName << " device." << RESET
+              << std::endl;
     return filteredDevices[0];
   }
 
@@ -91,8 +191,8 @@ std::string findKeyboardDevices() {
   bool validChoice = false;
 
   while (!validChoice) {
-    std::cout << CYAN << "Select a keyboard input device (1-" << filteredDevices.size()
-              << "): " << RESET;
+    std::cout << CYAN << "Select a " << lowerKindName << " input device (1-"
+              << filteredDevices.size() << "): " << RESET;
     int choice;
     std::cin >> choice;
 
@@ -107,200 +207,183 @@ std::string findKeyboardDevices() {
   return selectedDevice;
 }
 
-std::string resolveToByIdPath(const std::string &eventDevice) {
-  namespace fs = std::filesystem;
-  std::string byIdDir = "/dev/input/by-id/";
-
-  try {
-    if (!fs::exists(byIdDir)) {
-      return ""; // No by-id directory, fallback to event path
-    }
-
-    std::string targetPath = fs::canonical(deviceDir + eventDevice);
+std::string findKeyboardDevices() { return selectDevice(DEVICE_KEYBOARD, "Keyboard"); }
 
-    for (const auto &entry : fs::directory_iterator(byIdDir)) {
-      if (fs::is_symlink(entry)) {
-        std::string linkTarget = fs::canonical(entry);
-
-        if (linkTarget == targetPath) {
-          return entry.path().string();
-        }
-      }
-    }
-  } catch (const std::exception &e) {
-    std::cerr << RED << "Error resolving symlink: " << e.what() << RESET << std::endl;
-  }
-
-  return ""; // No matching symlink found
+static nlohmann::json identityToJson(const DeviceIdentity &identity) {
+  return {{"bus", identity.bus},       {"vendor", identity.vendor},
+          {"product", identity.product}, {"version", identity.version},
+          {"name", identity.name},     {"phys", identity.phys},
+          {"uniq", identity.uniq},     {"by_path", identity.byPath}};
 }
 
-std::string getInputDevicePath(std::string &configDir) {
-  std::string inputFilePath = configDir + "/input_device_path";
-  std::ifstream inputFile(inputFilePath);
-
-  if (inputFile.is_open()) {
-    std::string devicePath;
-    std::getline(inputFile, devicePath);
-    inputFile.close();
-    return devicePath;
-  }
-
-  return "";
+static DeviceIdentity identityFromJson(const nlohmann::json &json) {
+  DeviceIdentity identity;
+  identity.bus = json.value("bus", 0u);
+  identity.vendor = json.value("vendor", 0u);
+  identity.product = json.value("product", 0u);
+  identity.version = json.value("version", 0u);
+  identity.name = json.value("name", "");
+  identity.phys = json.value("phys", "");
+  identity.uniq = json.value("uniq", "");
+  identity.byPath = json.value("by_path", "");
+  return identity;
 }
 
-void saveInputDevice(std::string &configDir) {
-  std::string selectedDevice = findKeyboardDevices();
-  if (!selectedDevice.empty()) {
-    std::string byIdPath = resolveToByIdPath(selectedDevice);
-    std::string deviceToSave;
+// Devices that cannot be told apart without uniq/phys/by-path share a key
+static std::string identityKey(const DeviceIdentity &identity) {
+  return std::to_string(identity.bus) + ":" + std::to_string(identity.vendor) + ":" +
+         std::to_string(identity.product) + ":" + identity.name;
+}
 
-    if (!byIdPath.empty()) {
-      std::cout << GREEN << "\nUsing by-id path..." << RESET << std::endl;
-      deviceToSave = byIdPath;
-    } else {
-      std::cout << YELLOW << BOLD
-                << "\nNo by-id symlink found, using non-persistent event path..." << RESET
-                << std::endl;
-      deviceToSave = deviceDir + selectedDevice;
+// Find the current event node of a saved device, "" if it is absent or ambiguous, or if only
+// another unit of the same model (another serial) is connected
+static std::string resolveIdentity(const DeviceIdentity &saved) {
+  scanInputDevices();
+  if (identityIndex.empty()) {
+    for (size_t i = 0; i < devices.size(); i++) {
+      identityIndex[identityKey(devices[i].identity)].push_back(i);
     }
-
-    std::ofstream outputFile(configDir + "/input_device_path");
-    outputFile << deviceToSave;
-    outputFile.close();
-    std::cout << GREEN << "Device path saved: " << deviceToSave << RESET << std::endl;
-  } else {
-    std::cerr << RED << "No device selected. Exiting." << RESET << std::endl;
-    exit(1);
   }
-}
 
-// Find and select mouse devices (event interface)
-std::string findMouseDevices() {
-  DIR *dir = opendir(deviceDir);
-  if (!dir) {
-    std::cerr << RED << "Failed to open /dev/input directory" << RESET << std::endl;
+  auto it = identityIndex.find(identityKey(saved));
+  if (it == identityIndex.end()) return "";
+  const std::vector<size_t> &candidates = it->second;
+
+  // identical models: the serial decides when there is one, otherwise the physical port
+  if (!saved.uniq.empty()) {
+    for (size_t i : candidates) {
+      if (devices[i].identity.uniq == saved.uniq) return deviceDir + devices[i].node;
+    }
+    // a keyboard with another serial is not the one that was selected, even if it is the
+    // only one of its model
+    std::cerr << YELLOW << "Saved device \"" << saved.name << "\" has serial " << saved.uniq
+              << ", but no connected device of that model has it." << RESET << std::endl;
     return "";
   }
-
-  std::vector<std::string> devices;
-  struct dirent *entry;
-
-  while ((entry = readdir(dir)) != NULL) {
-    if (strncmp(entry->d_name, "event", 5) == 0) {
-      devices.push_back(entry->d_name);
+  for (size_t i : candidates) {
+    if (!saved.byPath.empty() && devices[i].identity.byPath == saved.byPath) {
+      return deviceDir + devices[i].node;
+    }
+  }
+  for (size_t i : candidates) {
+    if (!saved.phys.empty() && devices[i].identity.phys == saved.phys) {
+      return deviceDir + devices[i].node;
     }
   }
 
-  closedir(dir);
+  if (candidates.size() == 1) return deviceDir + devices[candidates[0]].node;
+  return "";
+}
 
-  if (devices.empty()) {
-    std::cerr << RED << "No input devices found!" << RESET << std::endl;
-    return "";
+// Read saved device paths, re-resolving each one whose identity was saved with it
+static std::vector<std::string> loadDevicePaths(const std::string &pathFile,
+                                                const std::string &identityFile) {
+  std::vector<std::string> devicePaths;
+  std::ifstream inputFile(pathFile);
+  std::string devicePath;
+  while (std::getline(inputFile, devicePath)) {
+    if (!devicePath.empty()) devicePaths.push_back(devicePath);
   }
 
-  std::vector<std::string> filteredDevices;
-
-  std::cout << CYAN << "Available Mouse devices:" << RESET << std::endl;
+  nlohmann::json identities = nlohmann::json::array();
+  std::ifstream identityInput(identityFile);
+  if (identityInput.is_open()) {
+    try {
+      identityInput >> identities;
+    } catch (nlohmann::json::exception &e) {
+      std::cerr << RED << "Ignoring invalid " << identityFile << RESET << std::endl;
+    }
+  }
 
-  for (size_t i = 0, displayIndex = 1; i < devices.size(); ++i) {
-    std::string devicePath = deviceDir + devices[i];
-    struct libevdev *dev = nullptr;
-    int fd = open(devicePath.c_str(), O_RDONLY);
-    if (fd < 0) {
-      std::cerr << RED << "Error opening " << devicePath << RESET << std::endl;
+  std::vector<std::string> resolvedPaths;
+  for (size_t i = 0; i < devicePaths.size(); i++) {
+    if (i >= identities.size() || !identities[i].is_object()) {
+      resolvedPaths.push_back(devicePaths[i]); // saved by hand or by an older version
       continue;
     }
 
-    int rc = libevdev_new_from_fd(fd, &dev);
-    if (rc < 0) {
-      std::cerr << RED << "Failed to create evdev device for " << devicePath << RESET
-                << std::endl;
-      close(fd);
+    DeviceIdentity identity = identityFromJson(identities[i]);
+    std::string resolvedPath = resolveIdentity(identity);
+    if (resolvedPath.empty()) {
+      // never fall back to a path that may now belong to another device
+      std::cerr << YELLOW << "Saved device \"" << identity.name
+                << "\" is not connected or ambiguous, skipping it. Run wayvibes --device "
+                   "to select it again."
+                << RESET << std::endl;
       continue;
     }
+    resolvedPaths.push_back(resolvedPath);
+  }
 
-    // Identify mice by presence of REL_X/REL_Y or BTN_LEFT
-    bool isMouse = libevdev_has_event_code(dev, EV_REL, REL_X) ||
-                   libevdev_has_event_code(dev, EV_KEY, BTN_LEFT);
-    if (isMouse) {
-      std::cout << CYAN << BOLD << displayIndex << ". " << RESET << YELLOW
-                << libevdev_get_name(dev) << RESET << " (" << devices[i] << ")"
-                << std::endl;
-      filteredDevices.push_back(devices[i]);
-      displayIndex++;
-    }
+  return resolvedPaths;
+}
 
-    libevdev_free(dev);
-    close(fd);
+// Save the selected event node as a stable path plus its identity
+static void saveDevice(const std::string &selectedDevice, const std::string &pathFile,
+                       const std::string &identityFile) {
+  const InputDeviceInfo *device = nullptr;
+  for (const InputDeviceInfo &info : scanInputDevices()) {
+    if (info.node == selectedDevice) device = &info;
   }
 
-  if (filteredDevices.empty()) {
-    std::cerr << RED << "No suitable mouse input devices found!" << RESET << std::endl;
-    return "";
+  std::string deviceToSave;
+  if (device && !device->byId.empty()) {
+    std::cout << GREEN << "\nUsing by-id path..." << RESET << std::endl;
+    deviceToSave = device->byId;
+  } else {
+    std::cout << YELLOW << BOLD
+              << "\nNo by-id symlink found, using event path with device identity..."
+              << RESET << std::endl;
+    deviceToSave = deviceDir + selectedDevice;
   }
 
-  if (filteredDevices.size() == 1) {
-    std::cout << CYAN << "Selecting this mouse device." << RESET << std::endl;
-    return filteredDevices[0];
-  }
+  std::ofstream outputFile(pathFile);
+  outputFile << deviceToSave;
+  outputFile.close();
 
-  std::string selectedDevice;
-  bool validChoice = false;
+  std::ofstream identityOutput(identityFile);
+  nlohmann::json identities = nlohmann::json::array();
+  if (device) identities.push_back(identityToJson(device->identity));
+  identityOutput << identities.dump(2) << std::endl;
+  identityOutput.close();
 
-  while (!validChoice) {
-    std::cout << CYAN << "Select a mouse input device (1-" << filteredDevices.size()
-              << "): " << RESET;
-    int choice;
-    std::cin >> choice;
+  std::cout << GREEN << "Device path saved: " << deviceToSave << RESET << std::endl;
+}
 
-    if (choice >= 1 && choice <= filteredDevices.size()) {
-      selectedDevice = filteredDevices[choice - 1];
-      validChoice = true;
-    } else {
-      std::cerr << RED << "Invalid choice. Please try again." << RESET << std::endl;
-    }
+std::vector<std::string> getInputDevicePaths(std::string &configDir) {
+  return loadDevicePaths(configDir + "/input_device_path",
+                         configDir + "/input_device_identity");
+}
+
+void saveInputDevice(std::string &configDir) {
+  std::string selectedDevice = findKeyboardDevices();
+  if (!selectedDevice.empty()) {
+    saveDevice(selectedDevice, configDir + "/input_device_path",
+               configDir + "/input_device_identity");
+  } else {
+    std::cerr << RED << "No device selected. Exiting." << RESET << std::endl;
+    exit(1);
   }
+}
 
-  return selectedDevice;
+// Find and select mouse devices (event interface); touchpads click with BTN_LEFT too
+std::string findMouseDevices() {
+  return selectDevice(DEVICE_MOUSE | DEVICE_TOUCHPAD | DEVICE_WHEEL, "Mouse");
 }
 
 std::string getMouseDevicePath(std::string &configDir) {
-  std::string inputFilePath = configDir + "/mouse_input_device_path";
-  std::ifstream inputFile(inputFilePath);
-
-  if (inputFile.is_open()) {
-    std::string devicePath;
-    std::getline(inputFile, devicePath);
-    inputFile.close();
-    return devicePath;
-  }
-
-  return "";
+  std::vector<std::string> devicePaths = loadDevicePaths(
+      configDir + "/mouse_input_device_path", configDir + "/mouse_input_device_identity");
+  return devicePaths.empty() ? "" : devicePaths[0];
 }
 
 void saveMouseDevice(std::string &configDir) {
   std::string selectedDevice = findMouseDevices();
   if (!selectedDevice.empty()) {
-    std::string byIdPath = resolveToByIdPath(selectedDevice);
-    std::string deviceToSave;
-
-    if (!byIdPath.empty()) {
-      std::cout << GREEN << "\nUsing by-id path..." << RESET << std::endl;
-      deviceToSave = byIdPath;
-    } else {
-      std::cout << YELLOW << BOLD
-                << "\nNo by-id symlink found, using non-persistent event path..." << RESET
-                << std::endl;
-      deviceToSave = deviceDir + selectedDevice;
-    }
-
-    std::ofstream outputFile(configDir + "/mouse_input_device_path");
-    outputFile << deviceToSave;
-    outputFile.close();
-    std::cout << GREEN << "Mouse device path saved: " << deviceToSave << RESET
-              << std::endl;
+    saveDevice(selectedDevice, configDir + "/mouse_input_device_path",
+               configDir + "/mouse_input_device_identity");
   } else {
     std::cerr << RED << "No mouse device selected. Continuing without mouse." << RESET
               << std::endl;
   }
-}
\ No newline at end of file
+}
@@ -2,7 +2,32 @@
 #define DEVICE_H
 
 #include <string>
-#include <unordered_map>
+#include <vector>
+
+enum DeviceKind {
+  DEVICE_KEYBOARD = 1,
+  DEVICE_MOUSE = 2,
+  DEVICE_TOUCHPAD = 4,
+  DEVICE_WHEEL = 8,
+};
+
+// Stable identity of an input device, saved so the same device is found after reboots
+// even when its eventN node changes
+struct DeviceIdentity {
+  unsigned bus, vendor, product, version;
+  std::string name;
+  std::string phys;   // physical port, e.g. "usb-0000:00:14.0-2/input0"
+  std::string uniq;   // serial, often empty
+  std::string byPath; // /dev/input/by-path link, if any
+};
+
+// An input event node as described by sysfs
+struct InputDeviceInfo {
+  std::string node; // e.g. "event3"
+  std::string byId; // /dev/input/by-id link, if any
+  unsigned kinds;   // DeviceKind bits
+  DeviceIdentity identity;
+};
 
 // find available keyboard devices
 std::string findKeyboardDevices();
@@ -10,14 +35,11 @@ std::string findKeyboardDevices();
 // find available mouse devices
 std::string findMouseDevices();
 
-// Run the main loop listening to both keyboard and mouse devices
-void runMainLoopMulti(const std::string &keyboardDevicePath,
-                      const std::string &mouseDevicePath,
-                      const std::unordered_map<int, std::string> &keySoundMap,
-                      float volume, const std::string &soundpackPath);
+// forget the cached sysfs scan, e.g. after devices were plugged in
+void invalidateDeviceScan();
 
-// get the input device path from the configuration directory
-std::string getInputDevicePath(std::string &configDir);
+// get the input device paths (one per line) from the configuration directory
+std::vector<std::string> getInputDevicePaths(std::string &configDir);
 
 // save the selected input device path to the configuration directory
 void saveInputDevice(std::string &configDir);
@@ -0,0 +1,171 @@
+#include "eventsource.h"
+#include "stats.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INJECT_BATCH_DATAGRAMS 16
+
+static int openEvdev(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd >= 0) {
+    // timestamp events on the same clock the mixer schedules against
+    int clockId = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clockId);
+  }
+  return fd;
+}
+
+// evdev only ever returns whole events
+static size_t readEvdev(EventSource &source, struct input_event *events, size_t maxEvents) {
+  ssize_t n = read(source.fd, events, maxEvents * sizeof(struct input_event));
+  return n > 0 ? (size_t)n / sizeof(struct input_event) : 0;
+}
+
+static void closeFd(EventSource &source) {
+  if (source.fd >= 0) close(source.fd);
+  source.fd = -1;
+}
+
+static int openInjectSocket(const std::string &path) {
+  struct sockaddr_un addr = {};
+  if (path.size() >= sizeof(addr.sun_path)) return -1;
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  // left behind by a daemon that did not exit cleanly; anything else at the path is kept
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path.c_str());
+  mode_t mask = umask(0177); // other users must not type for this one
+  int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+  if (bound < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Every datagram is received into its own slot of the caller's buffer, then the slots are
+// packed together; one recvmmsg() takes all that are queued
+static size_t readInjectSocket(EventSource &source, struct input_event *events,
+                               size_t maxEvents) {
+  struct mmsghdr messages[INJECT_BATCH_DATAGRAMS];
+  struct iovec slots[INJECT_BATCH_DATAGRAMS];
+  size_t slotCount = maxEvents / INJECT_DATAGRAM_EVENTS;
+  if (slotCount > INJECT_BATCH_DATAGRAMS) slotCount = INJECT_BATCH_DATAGRAMS;
+  if (slotCount == 0) return 0;
+  memset(messages, 0, sizeof(messages));
+  for (size_t i = 0; i < slotCount; i++) {
+    slots[i].iov_base = events + i * INJECT_DATAGRAM_EVENTS;
+    slots[i].iov_len = INJECT_DATAGRAM_EVENTS * sizeof(struct input_event);
+    messages[i].msg_hdr.msg_iov = &slots[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // MSG_TRUNC: msg_len is the datagram's full length, so the dropped records can be counted
+  int received =
+      recvmmsg(source.fd, messages, (unsigned)slotCount, MSG_DONTWAIT | MSG_TRUNC, nullptr);
+  if (received <= 0) return 0;
+  size_t eventCount = 0;
+  unsigned long dropped = 0;
+  for (int i = 0; i < received; i++) {
+    // a trailing partial record is dropped, as is the rest of an oversized datagram
+    size_t n = messages[i].msg_len / sizeof(struct input_event);
+    if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      dropped += n - INJECT_DATAGRAM_EVENTS;
+      n = INJECT_DATAGRAM_EVENTS;
+    }
+    if (n && eventCount != (size_t)i * INJECT_DATAGRAM_EVENTS) {
+      memmove(events + eventCount, events + i * INJECT_DATAGRAM_EVENTS,
+              n * sizeof(struct input_event));
+    }
+    eventCount += n;
+  }
+  if (dropped) {
+    static bool warned = false;
+    if (!warned) {
+      std::cerr << "Injector datagrams carry at most " << INJECT_DATAGRAM_EVENTS
+                << " records, dropping the rest (counted in ctl stats)" << std::endl;
+      warned = true;
+    }
+    count(stats.injectDropped, dropped);
+  }
+  return eventCount;
+}
+
+static void closeInjectSocket(EventSource &source) {
+  closeFd(source);
+  unlink(source.path.c_str());
+}
+
+static int openInjectFifo(const std::string &path) {
+  if (mkfifo(path.c_str(), 0600) < 0 && errno != EEXIST) return -1;
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0 || !S_ISFIFO(st.st_mode)) return -1;
+  // opened for writing too, so the FIFO never reports end of file when a writer leaves
+  int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) return -1;
+  // checked on the open fd: an existing one must be ours and writable by us alone, or other
+  // users could type for this one
+  if (fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode) || st.st_uid != geteuid() ||
+      (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    std::cerr << "Refusing " << path << ": not a FIFO of this user, writable by it alone" << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// A stream: a record may be split across writes, so keep a partial tail for the next read
+static size_t readInjectFifo(EventSource &source, struct input_event *events, size_t maxEvents) {
+  unsigned char *bytes = (unsigned char *)events;
+  memcpy(bytes, source.partial, source.partialBytes);
+  ssize_t n = read(source.fd, bytes + source.partialBytes,
+                   maxEvents * sizeof(struct input_event) - source.partialBytes);
+  if (n <= 0) return 0;
+  size_t total = source.partialBytes + (size_t)n;
+  size_t eventCount = total / sizeof(struct input_event);
+  source.partialBytes = total % sizeof(struct input_event);
+  memcpy(source.partial, bytes + eventCount * sizeof(struct input_event), source.partialBytes);
+  return eventCount;
+}
+
+const EventSourceOps evdevSource = {"device", true, false, openEvdev, readEvdev, closeFd};
+const EventSourceOps injectSocketSource = {"inject socket", false, true, openInjectSocket,
+                                           readInjectSocket, closeInjectSocket};
+const EventSourceOps injectFifoSource = {"inject FIFO", false, true, openInjectFifo,
+                                         readInjectFifo, closeFd};
+
+bool openEventSource(const EventSourceOps &ops, const std::string &path, EventSource &source) {
+  source.ops = &ops;
+  source.path = path;
+  source.partialBytes = 0;
+  source.fd = ops.open(path);
+  return source.fd >= 0;
+}
+
+EventSource adoptEventSource(int fd, const std::string &path) {
+  EventSource source;
+  source.ops = &evdevSource;
+  source.fd = fd;
+  source.path = path;
+  source.partialBytes = 0;
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    if (S_ISSOCK(st.st_mode)) source.ops = &injectSocketSource;
+    if (S_ISFIFO(st.st_mode)) source.ops = &injectFifoSource;
+  }
+  return source;
+}
+
+void closeEventSource(EventSource &source) { source.ops->close(source); }
@@ -0,0 +1,62 @@
+#ifndef EVENTSOURCE_H
+#define EVENTSOURCE_H
+
+// Where the daemon loop gets input events from. Every source is a pollable fd yielding packed
+// struct input_event records, read a batch per wakeup and dispatched the same way whatever
+// the kind. evdev devices are one kind; injectors are the other: a Unix datagram socket
+// (`--inject`) or a FIFO (`--inject-fifo`) that local programs such as tests, remote desktop
+// bridges or macro tools write records to. Only EV_KEY records with value 1 (press) or 2
+// (auto-repeat) make a sound; the event time is CLOCK_MONOTONIC, 0 meaning "now". Injected
+// times in the future or older than INJECT_TIME_WINDOW_NS count as "now" too.
+
+#include <linux/input.h>
+#include <string>
+#include <sys/types.h>
+
+// Records one injector datagram carries at most; the rest of a longer one is dropped and
+// counted
+#define INJECT_DATAGRAM_EVENTS 8
+#define INJECT_TIME_WINDOW_NS 1000000000LL
+
+struct EventSource;
+
+// One kind of source: how it is opened, read and closed
+struct EventSourceOps {
+  const char *kind; // for messages
+  // io_uring may read it straight into its own buffers; others it only polls, and read()
+  // runs when ready, so every source is framed the same either way
+  bool ringReads;
+  bool injected; // event times come from another process, only trusted close to now
+  int (*open)(const std::string &path); // fd, or -1
+  // Read pending records into `events`, returns how many (0 if none)
+  size_t (*read)(EventSource &source, struct input_event *events, size_t maxEvents);
+  void (*close)(EventSource &source);
+};
+
+struct EventSource {
+  const EventSourceOps *ops;
+  int fd;
+  std::string path;
+  // FIFO writers may split a record across writes
+  unsigned char partial[sizeof(struct input_event)];
+  size_t partialBytes;
+};
+
+extern const EventSourceOps evdevSource;
+extern const EventSourceOps injectSocketSource; // Unix datagram socket, mode 0600
+extern const EventSourceOps injectFifoSource;   // created if missing, mode 0600
+
+// False (and source.fd -1) if it can't be opened
+bool openEventSource(const EventSourceOps &ops, const std::string &path, EventSource &source);
+
+// A source for an fd inherited over re-exec, its kind told by the file type
+EventSource adoptEventSource(int fd, const std::string &path);
+
+inline size_t readEventSource(EventSource &source, struct input_event *events,
+                              size_t maxEvents) {
+  return source.ops->read(source, events, maxEvents);
+}
+
+void closeEventSource(EventSource &source);
+
+#endif // EVENTSOURCE_H
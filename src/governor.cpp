@@ -0,0 +1,133 @@
+#include "governor.h"
+#include "audio.h"
+#include "soundpack.h"
+#include "stats.h"
+#include "trace.h"
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#define GOVERNOR_INTERVAL_NS 1000000000LL
+#define GOVERNOR_RECOVER_NS 10000000000LL // headroom needed before each step back up
+
+// Tight: the callback needs this much of its period, or the CPU is this busy while the
+// callback needs a fair share. Headroom: both well below, so levels don't flap.
+#define TIGHT_LOAD_PERMILLE 700
+#define BUSY_CPU_PERCENT 60
+#define BUSY_LOAD_PERMILLE 350
+#define HEADROOM_LOAD_PERMILLE 350
+#define HEADROOM_CPU_PERCENT 30
+
+struct LevelLimits {
+  const char *name;
+  unsigned maxVoices; // 0 = all
+  unsigned tailMs;    // 0 = voices play to the end
+  bool integerMix; // fixed-point mixer, where samples aren't stored as f32
+};
+
+static const LevelLimits levels[GOVERNOR_LEVELS] = {
+    {"full quality", 0, 0, false},
+    {"fewer voices", 32, 0, false},
+    {"short tails", 32, 150, false},
+    {"minimal", 8, 80, true},
+};
+
+static bool enabled = false;
+static int level = GOVERNOR_FULL;
+static long long nextCheckNs = 0;
+static long long headroomSinceNs = -1; // -1 = not in headroom
+static unsigned long lastOverruns = 0;
+static unsigned long lastXruns = 0;
+static bool switchedMixer = false; // integer mixing is ours to turn off again
+
+// Share of the last 10 s some task waited for a CPU (PSI), or the load average per CPU
+// where the kernel has no pressure stall information; -1 if neither can be read
+static int cpuPressurePercent() {
+  char buf[256];
+  int fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    const char *avg10 = nullptr;
+    if (n > 0) {
+      buf[n] = '\0';
+      avg10 = strstr(buf, "avg10=");
+    }
+    if (avg10) return (int)strtod(avg10 + 6, nullptr);
+  }
+
+  fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) return -1;
+  buf[n] = '\0';
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return (int)(strtod(buf, nullptr) * 100.0 / (cpus > 0 ? cpus : 1));
+}
+
+static void applyLevel(int next, unsigned long load, int cpuPercent) {
+  const LevelLimits &limits = levels[next];
+  setPlaybackLimits(limits.maxVoices, limits.tailMs);
+  // f32 samples would be converted per voice, and an f32 device every period: more work than
+  // the float mix saves
+  bool integer = limits.integerMix && getSampleFormat() != SAMPLE_F32 && audioDeviceS16();
+  if (integer && !integerMixing()) {
+    setIntegerMixing(true);
+    switchedMixer = true;
+  } else if (!integer && switchedMixer) {
+    setIntegerMixing(false);
+    switchedMixer = false;
+  }
+
+  std::cerr << "Load governor: " << (next > level ? "down" : "up") << " to level " << next
+            << " (" << limits.name << "), callback load " << load / 10 << "%";
+  if (cpuPercent >= 0) std::cerr << ", CPU pressure " << cpuPercent << "%";
+  std::cerr << std::endl;
+
+  level = next;
+  stats.governorLevel.store(level, std::memory_order_relaxed);
+  count(stats.governorChanges);
+  trace(TRACE_INSTANT, "governor level", "level", level);
+}
+
+const char *governorLevelName(int level) {
+  return level >= 0 && level < GOVERNOR_LEVELS ? levels[level].name : "unknown";
+}
+
+unsigned governorLevelVoices(int level) {
+  return level >= 0 && level < GOVERNOR_LEVELS ? levels[level].maxVoices : 0;
+}
+
+void setGovernorEnabled(bool enable) { enabled = enable; }
+
+void updateGovernor(long long nowNs) {
+  if (!enabled || nowNs < nextCheckNs) return;
+  nextCheckNs = nowNs + GOVERNOR_INTERVAL_NS;
+
+  unsigned long overruns = stats.overruns.load(std::memory_order_relaxed);
+  unsigned long xruns = stats.xruns.load(std::memory_order_relaxed);
+  bool missed = overruns != lastOverruns || xruns != lastXruns;
+  lastOverruns = overruns;
+  lastXruns = xruns;
+
+  unsigned long load = stats.callbackLoadPermille.load(std::memory_order_relaxed);
+  int cpuPercent = cpuPressurePercent();
+  bool tight = missed || load >= TIGHT_LOAD_PERMILLE ||
+               (cpuPercent >= BUSY_CPU_PERCENT && load >= BUSY_LOAD_PERMILLE);
+  bool headroom = !missed && load < HEADROOM_LOAD_PERMILLE && cpuPercent < HEADROOM_CPU_PERCENT;
+
+  if (tight) {
+    headroomSinceNs = -1;
+    if (level + 1 < GOVERNOR_LEVELS) applyLevel(level + 1, load, cpuPercent);
+  } else if (!headroom) {
+    headroomSinceNs = -1;
+  } else if (headroomSinceNs < 0) {
+    headroomSinceNs = nowNs;
+  } else if (level > GOVERNOR_FULL && nowNs - headroomSinceNs >= GOVERNOR_RECOVER_NS) {
+    headroomSinceNs = nowNs; // the next step up waits as long again
+    applyLevel(level - 1, load, cpuPercent);
+  }
+}
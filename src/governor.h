@@ -0,0 +1,23 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+// Load governor (`--governor`): while the audio callback runs short of its period, or the
+// machine is short of CPU, play through cheaper modes one level at a time, and step back up
+// once headroom has lasted a while
+enum GovernorLevel {
+  GOVERNOR_FULL,
+  GOVERNOR_FEWER_VOICES, // half the voices
+  GOVERNOR_SHORT_TAILS,  // voices also fade out after 150 ms
+  GOVERNOR_MINIMAL,      // 8 voices, 80 ms tails, fixed-point mixing on s16 devices
+  GOVERNOR_LEVELS
+};
+
+const char *governorLevelName(int level);
+unsigned governorLevelVoices(int level); // voice limit of a level, 0 = all
+
+void setGovernorEnabled(bool enabled);
+
+// Called by the daemon loop; re-evaluates about once a second and applies level changes
+void updateGovernor(long long nowNs);
+
+#endif // GOVERNOR_H
@@ -0,0 +1,295 @@
+#include "handoff.h"
+#include "samplebank.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/input.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Descriptor layout, native byte order (both sides run on the same machine):
+//   magic, device format, control fd, input fds + paths, soundpack path and options,
+//   dispatch table (KEY_CNT keys), variant indices, sample frame and channel counts,
+//   then the sample arena: every sample's stored data, 16-byte aligned.
+// Fields are written one by one so a newer binary doesn't depend on the old struct layout.
+#define HANDOFF_MAGIC "WVHAND05" // bumped whenever the layout changes
+#define HANDOFF_ENV "WAYVIBES_HANDOFF_FD"
+#define ARENA_ALIGN 16
+
+template <typename T> static void put(std::string &out, T value) {
+  out.append((const char *)&value, sizeof(value));
+}
+
+static void putString(std::string &out, const std::string &value) {
+  put(out, (ma_uint32)value.size());
+  out.append(value);
+}
+
+struct Reader {
+  const char *p;
+  const char *end;
+  bool ok = true;
+
+  template <typename T> T get() {
+    T value{};
+    if (ok && (size_t)(end - p) >= sizeof(T)) {
+      memcpy(&value, p, sizeof(T));
+      p += sizeof(T);
+    } else {
+      ok = false;
+    }
+    return value;
+  }
+
+  std::string getString() {
+    ma_uint32 length = get<ma_uint32>();
+    if (!ok || (size_t)(end - p) < length) {
+      ok = false;
+      return "";
+    }
+    std::string value(p, length);
+    p += length;
+    return value;
+  }
+};
+
+static bool writeAll(int fd, const void *data, size_t size) {
+  const char *bytes = (const char *)data;
+  while (size > 0) {
+    ssize_t n = write(fd, bytes, size);
+    if (n <= 0) return false;
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+static std::string encodeDescriptor(const Handoff &handoff) {
+  const Soundpack &pack = *handoff.soundpack;
+  std::string out(HANDOFF_MAGIC, 8);
+  put(out, pack.channels);
+  put(out, pack.sampleRate);
+  put(out, (ma_int32)handoff.controlFd);
+
+  put(out, (ma_uint32)handoff.deviceFds.size());
+  for (size_t i = 0; i < handoff.deviceFds.size(); i++) {
+    put(out, (ma_int32)handoff.deviceFds[i]);
+    putString(out, handoff.devicePaths[i]);
+  }
+
+  putString(out, pack.path);
+  put(out, (ma_uint8)pack.randomVariants);
+  put(out, (ma_uint8)pack.repeatMode);
+  put(out, (ma_uint32)pack.rngState);
+  put(out, (ma_int64)pack.repeatIntervalNs);
+  put(out, (ma_int32)pack.repeatSample);
+  put(out, (ma_uint8)pack.sampleFormat);
+  put(out, pack.gain);
+
+  put(out, (ma_uint32)pack.keys.size());
+  for (const KeySounds &key : pack.keys) {
+    put(out, (ma_int32)key.first);
+    put(out, (ma_uint16)key.count);
+    put(out, (ma_uint16)key.retrigger.group);
+    put(out, (ma_uint8)key.retrigger.mode);
+    put(out, (ma_uint8)key.retrigger.maxStack);
+    put(out, (ma_uint16)key.retrigger.fadeFrames);
+  }
+
+  put(out, (ma_uint32)pack.variants.size());
+  for (int variant : pack.variants) put(out, (ma_int32)variant);
+
+  put(out, (ma_uint32)pack.samples.size());
+  for (const auto &sample : pack.samples) {
+    put(out, (ma_uint64)sample->frameCount);
+    put(out, (ma_uint32)sample->channels);
+  }
+
+  out.resize((out.size() + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN, '\0');
+  return out;
+}
+
+// Sealed memfd holding the descriptor followed by the sample arena, or -1
+static int createHandoffMemfd(const Handoff &handoff) {
+  int fd = memfd_create("wayvibes-handoff", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) return -1;
+
+  std::string descriptor = encodeDescriptor(handoff);
+  bool written = writeAll(fd, descriptor.data(), descriptor.size());
+  for (const auto &sample : handoff.soundpack->samples) {
+    if (!written) break;
+    written = writeAll(fd, sample->data.data(), sample->data.size());
+  }
+
+  // the new process maps it read-only; seals guarantee nobody can change it underneath
+  if (!written || fcntl(fd, F_ADD_SEALS,
+                        F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool keepAcrossExec(int fd) { return fd < 0 || fcntl(fd, F_SETFD, 0) == 0; }
+
+// Path of the binary on disk; after an upgrade /proc/self/exe names the deleted old inode
+static std::string executablePath() {
+  char path[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (length <= 0) return "/proc/self/exe";
+  std::string exe(path, length);
+  const std::string deleted = " (deleted)";
+  if (exe.size() > deleted.size() &&
+      exe.compare(exe.size() - deleted.size(), deleted.size(), deleted) == 0) {
+    exe.resize(exe.size() - deleted.size());
+  }
+  return exe;
+}
+
+void reexecWithHandoff(const std::vector<std::string> &args, const Handoff &handoff) {
+  int memfd = createHandoffMemfd(handoff);
+  if (memfd < 0) {
+    std::cerr << "Failed to hand off the soundpack, re-exec aborted." << std::endl;
+    return;
+  }
+
+  bool kept = keepAcrossExec(memfd) && keepAcrossExec(handoff.controlFd);
+  for (int fd : handoff.deviceFds) kept = kept && keepAcrossExec(fd);
+
+  std::vector<char *> argv;
+  for (const std::string &arg : args) argv.push_back((char *)arg.c_str());
+  argv.push_back(nullptr);
+
+  if (kept) {
+    setenv(HANDOFF_ENV, std::to_string(memfd).c_str(), 1);
+    std::string exe = executablePath();
+    execv(exe.c_str(), argv.data());
+    std::cerr << "Failed to exec " << exe << ": " << strerror(errno) << std::endl;
+    unsetenv(HANDOFF_ENV);
+  }
+
+  fcntl(handoff.controlFd, F_SETFD, FD_CLOEXEC);
+  for (int fd : handoff.deviceFds) fcntl(fd, F_SETFD, FD_CLOEXEC);
+  close(memfd);
+}
+
+static bool decodeDescriptor(Reader &in, Handoff &handoff, const char *base) {
+  if (memcmp(in.p, HANDOFF_MAGIC, 8) != 0) return false;
+  in.p += 8;
+  Soundpack &pack = *handoff.soundpack;
+  pack.channels = in.get<ma_uint32>();
+  pack.sampleRate = in.get<ma_uint32>();
+  handoff.controlFd = in.get<ma_int32>();
+
+  ma_uint32 deviceCount = in.get<ma_uint32>();
+  for (ma_uint32 i = 0; in.ok && i < deviceCount; i++) {
+    handoff.deviceFds.push_back(in.get<ma_int32>());
+    handoff.devicePaths.push_back(in.getString());
+  }
+
+  pack.path = in.getString();
+  pack.randomVariants = in.get<ma_uint8>() != 0;
+  pack.repeatMode = (RepeatMode)in.get<ma_uint8>();
+  if (pack.repeatMode > REPEAT_SAMPLE) return false;
+  pack.rngState = in.get<ma_uint32>();
+  pack.repeatIntervalNs = in.get<ma_int64>();
+  pack.repeatSample = in.get<ma_int32>();
+  pack.sampleFormat = (SampleFormat)in.get<ma_uint8>();
+  if (pack.sampleFormat > SAMPLE_SYNTH) return false;
+  pack.gain = in.get<float>();
+  pack.lastRepeatNs.assign(KEY_CNT, 0);
+  pack.generation = 0; // predates anything this process loads
+
+  ma_uint32 keyCount = in.get<ma_uint32>();
+  if (keyCount != KEY_CNT) return false;
+  pack.keys.assign(KEY_CNT, KeySounds{0, 0, 0, {}});
+  for (KeySounds &key : pack.keys) {
+    key.first = in.get<ma_int32>();
+    key.count = in.get<ma_uint16>();
+    key.retrigger.group = in.get<ma_uint16>();
+    key.retrigger.mode = (RetriggerMode)in.get<ma_uint8>();
+    key.retrigger.maxStack = in.get<ma_uint8>();
+    key.retrigger.fadeFrames = in.get<ma_uint16>();
+    // the audio thread indexes its group table with these
+    if (key.retrigger.group >= KEY_CNT || key.retrigger.mode > RETRIGGER_RESTART ||
+        key.retrigger.maxStack > MAX_STACK_LIMIT) {
+      return false;
+    }
+  }
+
+  ma_uint32 variantCount = in.get<ma_uint32>();
+  for (ma_uint32 i = 0; in.ok && i < variantCount; i++) {
+    pack.variants.push_back(in.get<ma_int32>());
+  }
+
+  ma_uint32 sampleCount = in.get<ma_uint32>();
+  if (!in.ok || sampleCount > (size_t)(in.end - in.p) / 12) return false;
+  std::vector<Sample> samples(sampleCount);
+  for (ma_uint32 i = 0; in.ok && i < sampleCount; i++) {
+    samples[i].frameCount = in.get<ma_uint64>();
+    samples[i].channels = in.get<ma_uint32>();
+    samples[i].format = pack.sampleFormat;
+    if (samples[i].channels != 1 && samples[i].channels != pack.channels) return false;
+  }
+  if (!in.ok) return false;
+
+  // the arena is copied out so the mapping can go away with the memfd
+  size_t offset = (in.p - base + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  const unsigned char *arena = (const unsigned char *)base + offset;
+  size_t arenaSize = in.end - base - offset;
+  size_t used = 0;
+  for (Sample &sample : samples) {
+    size_t bytes = pack.sampleFormat == SAMPLE_SYNTH
+                       ? sizeof(SynthSound)
+                       : sample.frameCount * sample.channels * sampleFormatBytes(pack.sampleFormat);
+    if (bytes > arenaSize - used) return false;
+    sample.data.assign(arena + used, arena + used + bytes);
+    used += bytes;
+    pack.samples.push_back(internSample(std::move(sample)));
+  }
+
+  for (int variant : pack.variants) {
+    if (variant < 0 || variant >= (int)sampleCount) return false;
+  }
+  for (const KeySounds &key : pack.keys) {
+    if (key.count && (key.first < 0 || key.first + key.count > (int)variantCount)) return false;
+  }
+  return pack.repeatSample < (int)sampleCount;
+}
+
+bool takeHandoff(Handoff &handoff) {
+  const char *env = std::getenv(HANDOFF_ENV);
+  if (!env) return false;
+  int memfd = atoi(env);
+  unsetenv(HANDOFF_ENV); // not for whatever this process execs later
+
+  int requiredSeals = F_SEAL_SHRINK | F_SEAL_WRITE;
+  off_t size = lseek(memfd, 0, SEEK_END);
+  if ((fcntl(memfd, F_GET_SEALS) & requiredSeals) != requiredSeals || size <= 8) {
+    std::cerr << "Ignoring invalid re-exec handoff." << std::endl;
+    close(memfd);
+    return false;
+  }
+
+  void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, memfd, 0);
+  close(memfd);
+  if (mapped == MAP_FAILED) return false;
+
+  const char *base = (const char *)mapped;
+  Reader in{base, base + size};
+  handoff.soundpack = new Soundpack;
+  bool ok = decodeDescriptor(in, handoff, base);
+  munmap(mapped, size);
+
+  // inherited fds are ours either way; only the samples can be unusable
+  for (int fd : handoff.deviceFds) fcntl(fd, F_SETFD, FD_CLOEXEC);
+  if (handoff.controlFd >= 0) fcntl(handoff.controlFd, F_SETFD, FD_CLOEXEC);
+  if (!ok) {
+    std::cerr << "Re-exec handoff is corrupt, reloading the soundpack." << std::endl;
+    delete handoff.soundpack;
+    handoff.soundpack = nullptr;
+  }
+  return true;
+}
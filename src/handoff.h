@@ -0,0 +1,23 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "soundpack.h"
+#include <string>
+#include <vector>
+
+// State a daemon passes to its replacement across execve() (`wayvibes --reexec`)
+struct Handoff {
+  Soundpack *soundpack = nullptr;
+  std::vector<int> deviceFds; // open input devices, O_NONBLOCK, CLOCK_MONOTONIC stamped
+  std::vector<std::string> devicePaths;
+  int controlFd = -1; // listening control socket
+};
+
+// Write the soundpack into a sealed memfd and exec the wayvibes binary with `args`, keeping
+// the given fds open for it. Only returns if the exec failed.
+void reexecWithHandoff(const std::vector<std::string> &args, const Handoff &handoff);
+
+// Pick up the state left by reexecWithHandoff(); false when started normally
+bool takeHandoff(Handoff &handoff);
+
+#endif // HANDOFF_H
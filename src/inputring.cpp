@@ -0,0 +1,277 @@
+#include "inputring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_ENTRIES 64       // submission queue; the kernel sizes completions at twice that
+#define RING_BUFFERS 64       // provided buffers, must be a power of two
+#define RING_BUFFER_EVENTS 64 // per buffer, the same batch a poll() wakeup reads
+#define BUFFER_GROUP 0
+#define CONTROL_USER_DATA (~0ULL)
+#define POLL_USER_DATA (1ULL << 62) // or'ed with the source index
+
+// Opcode added in Linux 6.7, newer than the uapi headers this may build against
+#define OP_READ_MULTISHOT 49
+
+static int ringFd = -1;
+
+static void *sqRing = MAP_FAILED; // with the completion ring (IORING_FEAT_SINGLE_MMAP)
+static size_t sqRingSize = 0;
+static unsigned *sqHead, *sqTail, *sqArray;
+static unsigned sqMask, sqEntries;
+static struct io_uring_sqe *sqes = (struct io_uring_sqe *)MAP_FAILED;
+static size_t sqesSize = 0;
+static unsigned *cqHead, *cqTail;
+static unsigned cqMask;
+static struct io_uring_cqe *cqes;
+
+// Provided buffer ring; its tail overlays the first entry's resv field. The header's
+// io_uring_buf_ring can't be used from C++: its empty flexible array wrapper moves bufs.
+static struct io_uring_buf *bufferRing = (struct io_uring_buf *)MAP_FAILED;
+static unsigned short bufferTail = 0;
+static struct input_event buffers[RING_BUFFERS][RING_BUFFER_EVENTS];
+static int heldBuffer = -1; // handed out by the last takeInputRingEntry()
+
+static int controlPollFd = -1;
+
+static int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg,
+                 size_t argSize) {
+  return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int registerRing(unsigned opcode, void *arg, unsigned count) {
+  return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, count);
+}
+
+static unsigned unsubmitted() {
+  return *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+}
+
+static struct io_uring_sqe *nextSqe() {
+  if (unsubmitted() >= sqEntries) enter(unsubmitted(), 0, 0, nullptr, 0);
+  unsigned tail = *sqTail;
+  unsigned index = tail & sqMask;
+  struct io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqArray[index] = index;
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE); // submitted with the next enter()
+  return sqe;
+}
+
+// Keeps producing completions until it fails or the kernel runs out of buffers
+static void armRead(size_t source) {
+  struct io_uring_sqe *sqe = nextSqe();
+  sqe->opcode = OP_READ_MULTISHOT;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->fd = (int)source; // registered file index
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = source;
+}
+
+// One-shot, re-armed after each client: pending connections complete it again at once
+static void armControlPoll() {
+  struct io_uring_sqe *sqe = nextSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = controlPollFd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = CONTROL_USER_DATA;
+}
+
+// One-shot too: re-armed when the entry is taken, submitted after the caller has read
+static void armSourcePoll(size_t source) {
+  struct io_uring_sqe *sqe = nextSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = (int)source;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = POLL_USER_DATA | source;
+}
+
+static void provideBuffer(unsigned short id) {
+  struct io_uring_buf &buffer = bufferRing[bufferTail & (RING_BUFFERS - 1)];
+  buffer.addr = (unsigned long long)(uintptr_t)buffers[id];
+  buffer.len = sizeof(buffers[id]);
+  buffer.bid = id;
+  bufferTail++;
+  __atomic_store_n(&bufferRing[0].resv, bufferTail, __ATOMIC_RELEASE);
+}
+
+static bool supportsMultishotRead() {
+  alignas(struct io_uring_probe) unsigned char
+      memory[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)] = {};
+  struct io_uring_probe *probe = (struct io_uring_probe *)memory;
+  if (registerRing(IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+  return probe->last_op >= OP_READ_MULTISHOT &&
+         (probe->ops[OP_READ_MULTISHOT].flags & IO_URING_OP_SUPPORTED);
+}
+
+static bool mapRings(const struct io_uring_params &params) {
+  sqRingSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+  sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) return false;
+  sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = (struct io_uring_sqe *)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return false;
+
+  char *ring = (char *)sqRing;
+  sqHead = (unsigned *)(ring + params.sq_off.head);
+  sqTail = (unsigned *)(ring + params.sq_off.tail);
+  sqArray = (unsigned *)(ring + params.sq_off.array);
+  sqMask = *(unsigned *)(ring + params.sq_off.ring_mask);
+  sqEntries = params.sq_entries;
+  cqHead = (unsigned *)(ring + params.cq_off.head);
+  cqTail = (unsigned *)(ring + params.cq_off.tail);
+  cqMask = *(unsigned *)(ring + params.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+  return true;
+}
+
+static bool registerBuffers() {
+  bufferRing = (struct io_uring_buf *)mmap(
+      nullptr, RING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufferRing == MAP_FAILED) return false;
+  struct io_uring_buf_reg reg = {};
+  reg.ring_addr = (unsigned long long)(uintptr_t)bufferRing;
+  reg.ring_entries = RING_BUFFERS;
+  reg.bgid = BUFFER_GROUP;
+  if (registerRing(IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+  bufferTail = 0;
+  for (unsigned short id = 0; id < RING_BUFFERS; id++) provideBuffer(id);
+  return true;
+}
+
+bool openInputRing(const std::vector<int> &deviceFds, const std::vector<bool> &polled,
+                   int controlFd) {
+  closeInputRing();
+  if (deviceFds.empty()) return false;
+
+  // completions are only reaped by this thread, in waitInputRing(): let the kernel batch
+  // their work there instead of interrupting the thread per device wakeup (Linux 6.1)
+  struct io_uring_params params = {};
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  ringFd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (ringFd < 0) {
+    params = {};
+    ringFd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  }
+  if (ringFd < 0) return false;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG) ||
+      !supportsMultishotRead() || !mapRings(params) || !registerBuffers() ||
+      registerRing(IORING_REGISTER_FILES, (void *)deviceFds.data(), deviceFds.size()) < 0) {
+    closeInputRing();
+    return false;
+  }
+
+  for (size_t source = 0; source < deviceFds.size(); source++) {
+    if (deviceFds[source] < 0) continue;
+    if (polled[source]) {
+      armSourcePoll(source);
+    } else {
+      armRead(source);
+    }
+  }
+  controlPollFd = controlFd;
+  if (controlPollFd >= 0) armControlPoll();
+  if (enter(unsubmitted(), 0, 0, nullptr, 0) < 0) {
+    closeInputRing();
+    return false;
+  }
+  return true;
+}
+
+void closeInputRing() {
+  // closing the ring cancels its reads and drops its references to the device files
+  if (ringFd >= 0) close(ringFd);
+  ringFd = -1;
+  if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+  sqRing = MAP_FAILED;
+  if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+  sqes = (struct io_uring_sqe *)MAP_FAILED;
+  if (bufferRing != MAP_FAILED) munmap(bufferRing, RING_BUFFERS * sizeof(struct io_uring_buf));
+  bufferRing = (struct io_uring_buf *)MAP_FAILED;
+  heldBuffer = -1;
+  controlPollFd = -1;
+}
+
+int waitInputRing(int timeoutMs) {
+  unsigned ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) - *cqHead;
+  if (ready) {
+    if (unsubmitted()) enter(unsubmitted(), 0, 0, nullptr, 0);
+    return (int)ready;
+  }
+
+  struct __kernel_timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000LL};
+  struct io_uring_getevents_arg arg = {};
+  arg.ts = (unsigned long long)(uintptr_t)&timeout;
+  if (enter(unsubmitted(), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+            sizeof(arg)) < 0 &&
+      errno != ETIME && errno != EINTR) {
+    return -1;
+  }
+  return (int)(__atomic_load_n(cqTail, __ATOMIC_ACQUIRE) - *cqHead);
+}
+
+bool takeInputRingEntry(InputRingEntry &entry) {
+  if (heldBuffer >= 0) provideBuffer((unsigned short)heldBuffer);
+  heldBuffer = -1;
+
+  unsigned head = *cqHead;
+  while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe cqe = cqes[head & cqMask];
+    __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+
+    if (cqe.user_data == CONTROL_USER_DATA) {
+      armControlPoll(); // submitted by the next wait, after the caller accepted
+      entry = {INPUT_RING_CONTROL, 0, nullptr, 0};
+      return true;
+    }
+
+    if (cqe.user_data != CONTROL_USER_DATA && (cqe.user_data & POLL_USER_DATA)) {
+      size_t source = (size_t)(cqe.user_data & ~POLL_USER_DATA);
+      if (cqe.res < 0 || (cqe.res & (POLLERR | POLLHUP | POLLNVAL))) {
+        entry = {INPUT_RING_CLOSED, source, nullptr, 0};
+      } else {
+        armSourcePoll(source);
+        entry = {INPUT_RING_READY, source, nullptr, 0};
+      }
+      return true;
+    }
+
+    size_t source = (size_t)cqe.user_data;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+      if (!more) armRead(source);
+      heldBuffer = (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      entry = {INPUT_RING_EVENTS, source, buffers[heldBuffer],
+               (size_t)cqe.res / sizeof(struct input_event)};
+      return true;
+    }
+    if (more) continue;
+    if (cqe.res == -ENOBUFS || cqe.res == -EAGAIN || cqe.res == -EINTR) {
+      armRead(source); // the buffers were all in use; the events wait in the device
+      continue;
+    }
+    entry = {INPUT_RING_CLOSED, source, nullptr, 0}; // ENODEV, or end of file
+    return true;
+  }
+  return false;
+}
+
+void removeInputRingDevice(size_t source) {
+  if (ringFd < 0) return;
+  int fd = -1;
+  struct io_uring_files_update update = {};
+  update.offset = (unsigned)source;
+  update.fds = (unsigned long long)(uintptr_t)&fd;
+  registerRing(IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
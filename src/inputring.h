@@ -0,0 +1,45 @@
+#ifndef INPUTRING_H
+#define INPUTRING_H
+
+// Optional io_uring input backend (`--io-uring`). Every device gets one multishot read into
+// buffers the kernel picks from a shared pool, so a single io_uring_enter() both waits for and
+// returns the event batches of all devices; nothing is re-armed per batch. The control socket
+// is polled through the same ring, as are sources the ring should not read itself (injectors),
+// which the caller then reads. Needs Linux 6.7 (multishot reads); without it the daemon
+// keeps its poll() loop.
+
+#include <cstddef>
+#include <linux/input.h>
+#include <vector>
+
+enum InputRingKind {
+  INPUT_RING_EVENTS,  // a batch read from a device
+  INPUT_RING_CLOSED,  // the device went away (or hit end of file)
+  INPUT_RING_CONTROL, // the control socket has a client waiting
+  INPUT_RING_READY,   // a polled source has data to read
+};
+
+struct InputRingEntry {
+  InputRingKind kind;
+  size_t source; // index into the device fds the ring was opened with
+  const struct input_event *events;
+  size_t count;
+};
+
+// Register the device fds and arm their reads, or polls where `polled` is set; replaces a ring
+// opened before. False if the kernel can't do multishot reads with provided buffers.
+bool openInputRing(const std::vector<int> &deviceFds, const std::vector<bool> &polled,
+                   int controlFd);
+void closeInputRing();
+
+// Submit re-arms and wait up to timeoutMs for completions; returns how many are ready, 0 on
+// timeout or a signal, -1 on error
+int waitInputRing(int timeoutMs);
+
+// Next completion; an entry's events stay valid until the following call
+bool takeInputRingEntry(InputRingEntry &entry);
+
+// Drop the ring's reference to a device that went away, so closing its fd releases it
+void removeInputRingDevice(size_t source);
+
+#endif // INPUTRING_H
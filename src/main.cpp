@@ -1,29 +1,91 @@
 #include "audio.h"
 #include "config.h"
+#include "control.h"
+#include "daemon.h"
 #include "device.h"
+#include "governor.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "status.h"
+#include "trace.h"
 #include <algorithm>
+#include <cmath>
 #include <filesystem>
 #include <iostream>
 #include <string>
 #include <unistd.h>
-#include <unordered_map>
+#include <vector>
 
 void printHelp() {
   std::cout << "Usage: wayvibes [options] [soundpack_path]\n"
+            << "       wayvibes ctl <command> [argument]\n"
+            << "       wayvibes status\n"
+            << "       wayvibes --reexec [options] [soundpack_path]\n"
             << "Options:\n"
             << "  --device          Select input device\n"
             << "  -v <volume>       Set volume (0.0-10.0) (default: 1.0)\n"
+            << "  --latency <ms>    Play sounds a fixed time after each key event, for\n"
+            << "                    constant latency (default: off, play immediately)\n"
+            << "  --dedup <ms>      Ignore a key press repeated by another device within\n"
+            << "                    this window, e.g. by keyd (default: 5, 0 = off)\n"
+            << "  --sample-format <f32|s16|ulaw>\n"
+            << "                    Keep samples in memory as f32, 16 bit or 8 bit µ-law;\n"
+            << "                    smaller formats cost a little mixer CPU (default: f32)\n"
+            << "  --mix <f32|s16>   Mix in float, or in 16 bit fixed point for hosts with slow\n"
+            << "                    float; s16 also keeps samples as s16 (default: f32)\n"
+            << "  --shed-voices     When the audio callback overruns its period, play fewer\n"
+            << "                    voices for a while instead of crackling\n"
+            << "  --governor        Under CPU pressure, step down to fewer voices, then short\n"
+            << "                    release tails, then 8 voices (mixed in fixed point with\n"
+            << "                    s16/ulaw samples) until it passes\n"
+            << "  --io-uring        Read input devices through io_uring multishot reads\n"
+            << "                    (Linux 6.7+, falls back to poll)\n"
+            << "  --inject <socket> Also play input_event records sent as datagrams to this\n"
+            << "                    Unix socket (created with mode 0600)\n"
+            << "  --inject-fifo <fifo>\n"
+            << "                    The same through a FIFO, created if missing\n"
+            << "  --trace <file>    Write a Chrome/Perfetto trace of the event-to-audio\n"
+            << "                    pipeline to <file> (also: ctl trace <file>|stop)\n"
+            << "  --metrics-file <file>\n"
+            << "                    Write Prometheus metrics to <file> (mode 0644) every\n"
+            << "                    5s, for node_exporter's textfile collector\n"
+            << "  --metrics-listen <port|socket>\n"
+            << "                    Serve Prometheus metrics on a Unix socket (mode 0600),\n"
+            << "                    or on 127.0.0.1:<port>, where every local user can\n"
+            << "                    read them, keystroke counts included\n"
             << "  --background, -bg Run in background (detached from terminal)\n"
+            << "  --reexec          Restart the running wayvibes (e.g. after an upgrade or\n"
+            << "                    with new options), keeping its decoded soundpack and\n"
+            << "                    devices; no options = the current command line\n"
             << "  --help, -h       Show this help message\n"
+            << "Commands for a running wayvibes (ctl):\n"
+            << "  volume [0.0-10.0], mute, unmute, toggle-mute, pack [path], reload,\n"
+            << "  rescan, status, stats, trace [file|stop], allocs (allocation tracking builds)\n"
             << "Note: default soundpack path is './' (current directory) "
             << "Example: wayvibes ~/wayvibes/akko_lavender_purples/ -v 3" << std::endl;
 }
 
 int main(int argc, char *argv[]) {
+  // thin client: talk to the running daemon without touching audio or soundpacks
+  if (argc > 1 && std::string(argv[1]) == "ctl") return runControlClient(argc - 2, argv + 2);
+  if (argc > 1 && std::string(argv[1]) == "status") return printStatusPage();
+  if (argc > 1 && std::string(argv[1]) == "--reexec") {
+    std::vector<char *> request = {(char *)"reexec"};
+    request.insert(request.end(), argv + 2, argv + argc);
+    return runControlClient((int)request.size(), request.data());
+  }
+
   std::string soundpackPath = "./";
   float volume = 1.0f;
+  float latencyMs = 0.0f;
+  float dedupMs = 5.0f;
   std::string configDir;
+  std::string tracePath;
+  std::string metricsFile;
+  std::string metricsListen;
   bool silent = false;
+  bool sampleFormatGiven = false;
+  bool governor = false;
   const char *xdgConfigHome = std::getenv("XDG_CONFIG_HOME");
   configDir = (xdgConfigHome ? xdgConfigHome : std::string(getenv("HOME")) + "/.config") +
               "/wayvibes";
@@ -42,8 +104,70 @@ int main(int argc, char *argv[]) {
         volume = std::stof(argv[i + 1]);
         i++;
       } catch (...) {
+        volume = NAN;
+      }
+      if (!std::isfinite(volume)) {
         std::cerr << "Invalid volume argument. Using default volume(1.0)." << std::endl;
+        volume = 1.0f;
+      }
+    } else if (std::string(argv[i]) == "--latency" && (i + 1) < argc) {
+      try {
+        latencyMs = std::stof(argv[i + 1]);
+        i++;
+      } catch (...) {
+        latencyMs = NAN;
+      }
+      if (!std::isfinite(latencyMs)) {
+        std::cerr << "Invalid latency argument. Playing sounds immediately." << std::endl;
+        latencyMs = 0.0f;
       }
+    } else if (std::string(argv[i]) == "--dedup" && (i + 1) < argc) {
+      try {
+        dedupMs = std::stof(argv[i + 1]);
+        i++;
+      } catch (...) {
+        dedupMs = NAN;
+      }
+      if (!std::isfinite(dedupMs)) {
+        std::cerr << "Invalid dedup argument. Using default window(5ms)." << std::endl;
+        dedupMs = 5.0f;
+      }
+    } else if (std::string(argv[i]) == "--sample-format" && (i + 1) < argc) {
+      std::string format = argv[++i];
+      sampleFormatGiven = true;
+      if (format == "f32") {
+        setSampleFormat(SAMPLE_F32);
+      } else if (format == "s16") {
+        setSampleFormat(SAMPLE_S16);
+      } else if (format == "ulaw") {
+        setSampleFormat(SAMPLE_ULAW);
+      } else {
+        std::cerr << "Invalid sample format: " << format << ". Using f32." << std::endl;
+      }
+    } else if (std::string(argv[i]) == "--mix" && (i + 1) < argc) {
+      std::string mix = argv[++i];
+      if (mix == "s16" || mix == "f32") {
+        setIntegerMixing(mix == "s16");
+      } else {
+        std::cerr << "Invalid mix format: " << mix << ". Using f32." << std::endl;
+      }
+    } else if (std::string(argv[i]) == "--shed-voices") {
+      setVoiceShedding(true);
+    } else if (std::string(argv[i]) == "--governor") {
+      setGovernorEnabled(true);
+      governor = true;
+    } else if (std::string(argv[i]) == "--io-uring") {
+      setIoUringInput(true);
+    } else if (std::string(argv[i]) == "--inject" && (i + 1) < argc) {
+      setInjectSocket(argv[++i]);
+    } else if (std::string(argv[i]) == "--inject-fifo" && (i + 1) < argc) {
+      setInjectFifo(argv[++i]);
+    } else if (std::string(argv[i]) == "--trace" && (i + 1) < argc) {
+      tracePath = argv[++i];
+    } else if (std::string(argv[i]) == "--metrics-file" && (i + 1) < argc) {
+      metricsFile = argv[++i];
+    } else if (std::string(argv[i]) == "--metrics-listen" && (i + 1) < argc) {
+      metricsListen = argv[++i];
     } else if (std::string(argv[i]) == "--background" || std::string(argv[i]) == "-bg") {
       silent = true;
     } else if (std::string(argv[i]) == "--help" || std::string(argv[i]) == "-h") {
@@ -57,6 +181,21 @@ int main(int argc, char *argv[]) {
       return 1;
     }
   }
+  // the integer mixer reads s16 samples as they are
+  if (integerMixing() && !sampleFormatGiven) setSampleFormat(SAMPLE_S16);
+  // the governor's minimal level mixes in fixed point, which only saves work on a device
+  // that takes int16; compact samples are a choice for a little CPU over precision anyway
+  if (governor && getSampleFormat() != SAMPLE_F32) setS16Output(true);
+
+  // started by `--reexec`: the control socket we'd collide with is our own
+  Handoff handoff;
+  bool reexeced = takeHandoff(handoff);
+
+  if (!reexeced && isDaemonRunning()) {
+    std::cerr << "wayvibes is already running. Use 'wayvibes ctl <command>' to control it."
+              << std::endl;
+    return 1;
+  }
 
   if (silent) {
     pid_t pid = fork();
@@ -77,6 +216,8 @@ int main(int argc, char *argv[]) {
   }
 
   volume = std::clamp(volume, 0.0f, 10.0f);
+  latencyMs = std::clamp(latencyMs, 0.0f, 1000.0f);
+  dedupMs = std::clamp(dedupMs, 0.0f, 1000.0f);
 
   if (initializeAudioEngine() != MA_SUCCESS) {
     if (!silent) std::cerr << "Failed to initialize audio engine" << std::endl;
@@ -84,26 +225,63 @@ int main(int argc, char *argv[]) {
   }
 
   if (!silent) std::cout << "Soundpack: " << soundpackPath << std::endl;
-  std::unordered_map<int, std::string> keySoundMap =
-      loadKeySoundMappings(soundpackPath + "/config.json");
-
-  std::string devicePath = getInputDevicePath(configDir);
-  std::string mouseDevicePath = getMouseDevicePath(configDir);
-
-  if (devicePath.empty()) {
-    if (!silent) std::cout << "No device found. Prompting user." << std::endl;
-    saveInputDevice(configDir);
-    devicePath = getInputDevicePath(configDir);
+  Soundpack *soundpack = nullptr;
+  if (handoff.soundpack) {
+    // samples are only reusable if they were decoded for this device and storage format
+    // (synthesized sounds are stored the same way whatever the format)
+    std::error_code error;
+    if (handoff.soundpack->channels == device.playback.channels &&
+        handoff.soundpack->sampleRate == device.sampleRate &&
+        (handoff.soundpack->sampleFormat == getSampleFormat() ||
+         handoff.soundpack->sampleFormat == SAMPLE_SYNTH) &&
+        std::filesystem::equivalent(handoff.soundpack->path, soundpackPath, error)) {
+      soundpack = handoff.soundpack;
+      if (!silent) std::cout << "Adopted decoded soundpack from previous process." << std::endl;
+    } else {
+      delete handoff.soundpack;
+    }
+  }
+  if (!soundpack) {
+    SoundpackConfig soundpackConfig;
+    if (!loadSoundpackConfig(soundpackPath + "/config.json", soundpackConfig)) return 1;
+    soundpack = new Soundpack;
+    loadSoundpack(*soundpack, soundpackConfig, soundpackPath, device.playback.channels,
+                  device.sampleRate);
   }
+  setScheduledLatency(latencyMs);
+  setDedupWindow(dedupMs);
 
-  if (mouseDevicePath.empty()) {
-    if (!silent) std::cout << "No mouse device found. Prompting user." << std::endl;
-    saveMouseDevice(configDir);
+  // inherited devices are already open; only a normal start needs the saved ones
+  std::vector<std::string> devicePaths;
+  std::string mouseDevicePath;
+  if (!handoff.deviceFds.empty() || handoff.controlFd >= 0) adoptInputDevices(handoff);
+  if (handoff.deviceFds.empty()) {
+    devicePaths = getInputDevicePaths(configDir);
     mouseDevicePath = getMouseDevicePath(configDir);
+
+    if (devicePaths.empty()) {
+      if (!silent) std::cout << "No device found. Prompting user." << std::endl;
+      saveInputDevice(configDir);
+      devicePaths = getInputDevicePaths(configDir);
+    }
+
+    if (mouseDevicePath.empty()) {
+      if (!silent) std::cout << "No mouse device found. Prompting user." << std::endl;
+      saveMouseDevice(configDir);
+      mouseDevicePath = getMouseDevicePath(configDir);
+    }
   }
 
-  runMainLoopMulti(devicePath, mouseDevicePath, keySoundMap, volume, soundpackPath);
+  if (!tracePath.empty() && !startTrace(tracePath)) {
+    std::cerr << "Failed to open trace file " << tracePath << std::endl;
+  }
+  if (!startMetricsExporter(metricsFile, metricsListen)) {
+    std::cerr << "Failed to listen for metrics on " << metricsListen << std::endl;
+  }
+  runMainLoopMulti(configDir, devicePaths, mouseDevicePath, soundpack, volume);
+  stopMetricsExporter();
+  stopTrace();
 
-  ma_engine_uninit(&engine);
+  uninitializeAudioEngine();
   return 0;
 }
@@ -0,0 +1,312 @@
+#include "metrics.h"
+#include "stats.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#define TEXTFILE_INTERVAL_MS 5000
+#define REQUEST_WAIT_MS 100 // for an HTTP request line before answering with plain text
+
+static std::mutex devicesMutex;
+static std::vector<std::string> devices;
+
+static std::thread exporter;
+static int listenFd = -1;
+static int stopPipe[2] = {-1, -1};
+static std::string textfile;
+static std::string socketPath; // Unix socket to remove on stop
+
+void setMetricsDevices(const std::vector<std::string> &paths) {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  devices = paths;
+  // indices now name other devices; this runs on the input loop, the counters' writer
+  for (auto &counter : stats.deviceEvents) counter.store(0, std::memory_order_relaxed);
+}
+
+static unsigned long get(const std::atomic<unsigned long> &counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+static std::string escapeLabel(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"') escaped += '\\';
+    escaped += c == '\n' ? 'n' : c;
+  }
+  return escaped;
+}
+
+static void metric(std::ostream &out, const char *name, const char *type, const char *help,
+                   unsigned long value) {
+  out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n"
+      << name << " " << value << "\n";
+}
+
+// Cumulative buckets at the given upper bounds (seconds); `countBelow` maps a bound to the
+// number of observations at or below it
+template <typename CountBelow>
+static void histogram(std::ostream &out, const char *name, const char *help,
+                      const std::vector<double> &bounds, CountBelow countBelow,
+                      unsigned long total, double sumSeconds) {
+  out << "# HELP " << name << " " << help << "\n# TYPE " << name << " histogram\n";
+  for (double bound : bounds) {
+    out << name << "_bucket{le=\"" << bound << "\"} " << countBelow(bound) << "\n";
+  }
+  out << name << "_bucket{le=\"+Inf\"} " << total << "\n"
+      << name << "_sum " << sumSeconds << "\n"
+      << name << "_count " << total << "\n";
+}
+
+std::string formatMetrics() {
+  std::ostringstream out;
+  out << std::setprecision(9);
+  out << "# HELP wayvibes_events_read_total Input events read, per device\n"
+      << "# TYPE wayvibes_events_read_total counter\n";
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    for (size_t i = 0; i < devices.size() && i < STATS_DEVICES; i++) {
+      out << "wayvibes_events_read_total{device=\"" << escapeLabel(devices[i]) << "\"} "
+          << get(stats.deviceEvents[i]) << "\n";
+    }
+  }
+  metric(out, "wayvibes_triggers_total", "counter", "Sounds queued for playback",
+         get(stats.triggers));
+  metric(out, "wayvibes_triggers_dropped_total", "counter",
+         "Sounds dropped because the trigger queue was full", get(stats.triggersDropped));
+  metric(out, "wayvibes_duplicates_dropped_total", "counter",
+         "Key presses dropped as repeated by another device", get(stats.duplicatesDropped));
+  metric(out, "wayvibes_inject_dropped_total", "counter",
+         "Injected records dropped past a datagram's cap", get(stats.injectDropped));
+  metric(out, "wayvibes_late_triggers_total", "counter",
+         "Sounds that missed their scheduled start", get(stats.lateTriggers));
+  metric(out, "wayvibes_voice_steals_total", "counter",
+         "Voices cut to make room for a new sound", get(stats.voiceSteals));
+  metric(out, "wayvibes_limited_frames_total", "counter",
+         "Output frames reduced by the master limiter", get(stats.limitedFrames));
+  metric(out, "wayvibes_reloads_total", "counter", "Soundpacks swapped in",
+         get(stats.reloads));
+  metric(out, "wayvibes_active_voices", "gauge", "Voices playing after the last period",
+         get(stats.activeVoices));
+  metric(out, "wayvibes_xruns_total", "counter",
+         "Underruns: the audio device ran dry or was interrupted", get(stats.xruns));
+  metric(out, "wayvibes_audio_overruns_total", "counter",
+         "Audio callbacks that took longer than their period", get(stats.overruns));
+  metric(out, "wayvibes_audio_overrun_voices", "gauge",
+         "Voices playing during the last overrun", get(stats.overrunVoices));
+  out << "# HELP wayvibes_audio_callback_load Rolling audio callback duration / period\n"
+      << "# TYPE wayvibes_audio_callback_load gauge\n"
+      << "wayvibes_audio_callback_load " << get(stats.callbackLoadPermille) / 1000.0 << "\n";
+  metric(out, "wayvibes_voice_cap", "gauge", "Voices the mixer currently allows",
+         get(stats.voiceCap));
+  metric(out, "wayvibes_governor_level", "gauge",
+         "Load governor level, 0 = full quality (see --governor)", get(stats.governorLevel));
+  metric(out, "wayvibes_governor_changes_total", "counter", "Load governor level changes",
+         get(stats.governorChanges));
+  metric(out, "wayvibes_sample_bytes", "gauge", "Memory of the current soundpack's samples",
+         get(stats.sampleBytes));
+  metric(out, "wayvibes_sample_bank_bytes", "gauge",
+         "Memory of all loaded samples after deduplication", get(stats.bankStoredBytes));
+  metric(out, "wayvibes_sample_bank_referenced_bytes", "gauge",
+         "Memory all loaded samples would take without deduplication",
+         get(stats.bankReferencedBytes));
+
+  // snapshots, so the buckets add up even while the callback keeps counting
+  unsigned long callbackCounts[CALLBACK_BUCKETS];
+  unsigned long callbacks = 0;
+  for (int i = 0; i < CALLBACK_BUCKETS; i++) {
+    callbackCounts[i] = get(stats.callbackBuckets[i]);
+    callbacks += callbackCounts[i];
+  }
+  std::vector<double> callbackBounds;
+  for (int i = 0; i < CALLBACK_BUCKETS - 1; i++) {
+    callbackBounds.push_back(CALLBACK_BUCKET_US * 1e-6 * (1 << i));
+  }
+  histogram(
+      out, "wayvibes_audio_callback_seconds", "Time spent rendering one audio period",
+      callbackBounds,
+      [&](double bound) {
+        unsigned long below = 0;
+        for (int i = 0; i < CALLBACK_BUCKETS - 1 && callbackBounds[i] <= bound; i++) {
+          below += callbackCounts[i];
+        }
+        return below;
+      },
+      callbacks, get(stats.callbackTimeNs) * 1e-9);
+
+  unsigned long latencyCounts[LATENCY_BUCKETS];
+  unsigned long triggers = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    latencyCounts[i] = get(stats.latencyBuckets[i]);
+    triggers += latencyCounts[i];
+  }
+  histogram(
+      out, "wayvibes_trigger_latency_seconds",
+      "Time from the key event to the first output frame of its sound",
+      {0.0005, 0.001, 0.002, 0.003, 0.005, 0.0075, 0.01, 0.015, 0.02, 0.03, 0.05},
+      [&](double bound) {
+        // bucket i holds latencies up to (i + 1) * LATENCY_BUCKET_US
+        int last = (int)(bound * 1e6 / LATENCY_BUCKET_US + 0.5);
+        unsigned long below = 0;
+        for (int i = 0; i < last && i < LATENCY_BUCKETS - 1; i++) below += latencyCounts[i];
+        return below;
+      },
+      triggers, get(stats.latencySumNs) * 1e-9);
+  return out.str();
+}
+
+// Replace the textfile atomically: the collector may read it at any time. Mode 0644 whatever
+// the umask: node_exporter usually runs as its own user and has to read the file.
+static void writeTextfile() {
+  std::string temporary = textfile + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return;
+  fchmod(fd, 0644);
+  FILE *file = fdopen(fd, "w");
+  if (!file) {
+    close(fd);
+    unlink(temporary.c_str());
+    return;
+  }
+  std::string text = formatMetrics();
+  bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+  if (fclose(file) == 0 && written) {
+    rename(temporary.c_str(), textfile.c_str());
+  } else {
+    unlink(temporary.c_str());
+  }
+}
+
+// Plain text for `socat - UNIX-CONNECT:...`, an HTTP response for Prometheus and curl
+static void answerScrape(int clientFd) {
+  char request[1024];
+  ssize_t n = 0;
+  struct pollfd pfd = {clientFd, POLLIN, 0};
+  if (poll(&pfd, 1, REQUEST_WAIT_MS) > 0) n = read(clientFd, request, sizeof(request));
+
+  std::string body = formatMetrics();
+  std::string reply = body;
+  if (n >= 4 && memcmp(request, "GET ", 4) == 0) {
+    reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+            std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+  }
+  size_t sent = 0;
+  while (sent < reply.size()) {
+    ssize_t w = send(clientFd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+    if (w <= 0) break;
+    sent += w;
+  }
+  close(clientFd);
+}
+
+static long long monotonicMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void exporterLoop() {
+  long long nextWriteMs = monotonicMs();
+  for (;;) {
+    int timeout = -1;
+    if (!textfile.empty()) {
+      long long now = monotonicMs();
+      if (now >= nextWriteMs) {
+        writeTextfile();
+        nextWriteMs = now + TEXTFILE_INTERVAL_MS;
+      }
+      timeout = (int)(nextWriteMs - now);
+    }
+
+    struct pollfd fds[2] = {{stopPipe[0], POLLIN, 0}, {listenFd, POLLIN, 0}};
+    if (poll(fds, listenFd >= 0 ? 2 : 1, timeout) < 0 && errno != EINTR) break;
+    if (fds[0].revents) break;
+    if (listenFd >= 0 && (fds[1].revents & POLLIN)) {
+      int clientFd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+      if (clientFd >= 0) answerScrape(clientFd);
+    }
+  }
+  if (!textfile.empty()) writeTextfile(); // final counts
+}
+
+static int listenOn(const std::string &address) {
+  bool port = !address.empty() && address.find_first_not_of("0123456789") == std::string::npos;
+  int fd = socket(port ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  int bound;
+  if (port) {
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never exposed beyond this machine
+    unsigned long number = strtoul(address.c_str(), NULL, 10);
+    if (number == 0 || number > 65535) {
+      close(fd);
+      return -1;
+    }
+    addr.sin_port = htons((unsigned short)number);
+    bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  } else {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (address.size() >= sizeof(addr.sun_path)) {
+      close(fd);
+      return -1;
+    }
+    strcpy(addr.sun_path, address.c_str());
+    // left behind by a previous run; anything else at the path is kept
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(addr.sun_path);
+    bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    // the per-device counters tell when keys are typed; nobody can connect before listen()
+    if (bound == 0 && chmod(addr.sun_path, 0600) < 0) {
+      unlink(addr.sun_path);
+      bound = -1;
+    }
+    if (bound == 0) socketPath = address;
+  }
+  if (bound < 0 || listen(fd, 8) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool startMetricsExporter(const std::string &textfilePath, const std::string &listenAddress) {
+  if (textfilePath.empty() && listenAddress.empty()) return true;
+  if (!listenAddress.empty()) {
+    listenFd = listenOn(listenAddress);
+    if (listenFd < 0) return false;
+  }
+  if (pipe2(stopPipe, O_CLOEXEC) != 0) return false;
+  textfile = textfilePath;
+  exporter = std::thread(exporterLoop);
+  return true;
+}
+
+void stopMetricsExporter() {
+  if (!exporter.joinable()) return;
+  if (write(stopPipe[1], "", 1) < 0) return;
+  exporter.join();
+  close(stopPipe[0]);
+  close(stopPipe[1]);
+  if (listenFd >= 0) close(listenFd);
+  listenFd = -1;
+  if (!socketPath.empty()) unlink(socketPath.c_str());
+  socketPath.clear();
+}
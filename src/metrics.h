@@ -0,0 +1,20 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+
+// The stats counters in Prometheus text format (version 0.0.4)
+std::string formatMetrics();
+
+// Label the per-device event counters; `paths` in poll order, as the daemon opened them
+void setMetricsDevices(const std::vector<std::string> &paths);
+
+// Export from a background thread: rewrite `textfilePath` (node_exporter's textfile
+// collector) every few seconds, and/or answer scrapes on `listenAddress`, a port on
+// 127.0.0.1 (open to every local user) or a Unix socket path (mode 0600). Either may be
+// empty. False if the socket can't be bound.
+bool startMetricsExporter(const std::string &textfilePath, const std::string &listenAddress);
+void stopMetricsExporter();
+
+#endif // METRICS_H
@@ -0,0 +1,86 @@
+#include "samplebank.h"
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+// Entries only hold weak references: the soundpacks own the samples
+static std::unordered_multimap<uint64_t, std::weak_ptr<const Sample>> bank;
+static std::mutex bankMutex; // loads run on the reload thread
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// 64-bit multiply-mix hash over the stored PCM, 32 bytes per step in four independent
+// lanes; matches are confirmed with memcmp, so it only has to spread well
+static uint64_t hashSample(const Sample &sample) {
+  const unsigned char *p = sample.data.data();
+  size_t size = sample.data.size();
+  const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+  uint64_t lanes[4] = {prime, prime * 3, prime * 5, prime * 7};
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      memcpy(&word, p + i + lane * 8, 8);
+      lanes[lane] = (lanes[lane] ^ word) * prime;
+      lanes[lane] ^= lanes[lane] >> 29;
+    }
+  }
+
+  uint64_t hash = mix64(lanes[0]) ^ mix64(lanes[1] + 1) ^ mix64(lanes[2] + 2) ^
+                  mix64(lanes[3] + 3);
+  for (; i < size; i++) hash = (hash ^ p[i]) * prime;
+
+  // same bytes in another layout are different audio
+  hash ^= mix64(sample.frameCount * 16 + sample.channels * 4 + sample.format);
+  return mix64(hash);
+}
+
+static bool sameSample(const Sample &a, const Sample &b) {
+  return a.format == b.format && a.channels == b.channels && a.frameCount == b.frameCount &&
+         a.data == b.data;
+}
+
+std::shared_ptr<const Sample> internSample(Sample &&sample) {
+  uint64_t hash = hashSample(sample);
+  std::lock_guard<std::mutex> lock(bankMutex);
+
+  auto range = bank.equal_range(hash);
+  for (auto it = range.first; it != range.second;) {
+    std::shared_ptr<const Sample> stored = it->second.lock();
+    if (!stored) {
+      it = bank.erase(it); // its soundpacks are gone
+      continue;
+    }
+    if (sameSample(*stored, sample)) return stored;
+    ++it;
+  }
+
+  auto stored = std::make_shared<const Sample>(std::move(sample));
+  bank.emplace(hash, stored);
+  return stored;
+}
+
+void sampleBankUsage(size_t &referenced, size_t &stored) {
+  std::lock_guard<std::mutex> lock(bankMutex);
+  referenced = stored = 0;
+  for (auto it = bank.begin(); it != bank.end();) {
+    // each soundpack holds one reference per sample slot that uses the entry
+    long owners = it->second.use_count();
+    std::shared_ptr<const Sample> sample = it->second.lock();
+    if (!sample) {
+      it = bank.erase(it);
+      continue;
+    }
+    stored += sample->data.size();
+    referenced += sample->data.size() * owners;
+    ++it;
+  }
+}
@@ -0,0 +1,17 @@
+#ifndef SAMPLEBANK_H
+#define SAMPLEBANK_H
+
+#include "soundpack.h"
+#include <memory>
+
+// Process-wide store of decoded samples, addressed by a hash of their content. Identical
+// audio loaded from different files or soundpacks is kept once; an entry is freed when the
+// last soundpack referencing it is.
+
+// The stored sample with the same content, or `sample` itself if it is new
+std::shared_ptr<const Sample> internSample(Sample &&sample);
+
+// Bytes the soundpacks reference in total, and the bytes actually stored
+void sampleBankUsage(size_t &referenced, size_t &stored);
+
+#endif // SAMPLEBANK_H
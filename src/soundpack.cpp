@@ -0,0 +1,475 @@
+#include "soundpack.h"
+#include "samplebank.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <linux/input.h>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+static std::atomic<unsigned> nextGeneration{1};
+static std::atomic<Soundpack *> pendingSoundpack{nullptr};
+static std::atomic<bool> reloading{false};
+
+#define SINC_ZERO_CROSSINGS 16 // per side of the resampling kernel at full bandwidth
+#define SINC_PHASES 256
+#define LOUDNESS_TARGET_DB -20.0f // short-term RMS packs are normalized to
+#define LOUDNESS_MAX_GAIN_DB 24.0f
+#define LOUDNESS_WINDOW_MS 10
+
+static SampleFormat sampleFormat = SAMPLE_F32;
+
+// f32 PCM between decoding and storage
+struct Pcm {
+  std::vector<float> frames;
+  ma_uint64 frameCount;
+  ma_uint32 channels;
+};
+
+size_t sampleFormatBytes(SampleFormat format) {
+  return format == SAMPLE_F32 ? sizeof(float) : format == SAMPLE_S16 ? sizeof(int16_t) : 1;
+}
+
+void setSampleFormat(SampleFormat format) { sampleFormat = format; }
+
+SampleFormat getSampleFormat() { return sampleFormat; }
+
+static int16_t floatToS16(float value) {
+  return (int16_t)std::lrint(std::clamp(value, -1.0f, 32767.0f / 32768.0f) * 32768.0f);
+}
+
+// G.711 µ-law: 8 bit logarithmic, about 13 bit of dynamic range
+static unsigned char ulawEncode(int16_t pcm) {
+  const int bias = 0x84, clip = 32635;
+  int sign = pcm < 0 ? 0x80 : 0;
+  int magnitude = std::min(sign ? -(int)pcm : (int)pcm, clip) + bias;
+  int exponent = 7;
+  for (int mask = 0x4000; !(magnitude & mask) && exponent > 0; mask >>= 1) exponent--;
+  int mantissa = (magnitude >> (exponent + 3)) & 0x0F;
+  return (unsigned char)~(sign | (exponent << 4) | mantissa);
+}
+
+float ulawToFloat(unsigned char ulaw) {
+  ulaw = ~ulaw;
+  int magnitude = ((((ulaw & 0x0F) << 3) + 0x84) << ((ulaw >> 4) & 7)) - 0x84;
+  return (ulaw & 0x80 ? -magnitude : magnitude) / 32768.0f;
+}
+
+// Band-limited resampling by ratio = output rate / input rate: a Blackman-windowed sinc,
+// tabulated at SINC_PHASES fractional offsets and interpolated between them. Channels are
+// filtered separately from zero-padded planar copies, so the inner loop is a contiguous
+// dot product.
+std::vector<float> resampleFrames(const float *frames, ma_uint64 frameCount,
+                                  ma_uint32 channels, double ratio) {
+  ma_uint64 outFrames = (ma_uint64)std::ceil(frameCount * ratio);
+  std::vector<float> out(outFrames * channels, 0.0f);
+  if (frameCount == 0) return out;
+
+  // cut below the lower of both Nyquist rates, leaving room for the transition band
+  double cutoff = std::min(1.0, ratio) * 0.95;
+  int half = (int)std::ceil(SINC_ZERO_CROSSINGS / cutoff);
+  int width = 2 * half;
+
+  // kernel row p weights input frames floor(pos) - half + 1 ... floor(pos) + half for a
+  // position p / SINC_PHASES past floor(pos)
+  std::vector<float> kernel((SINC_PHASES + 1) * width);
+  for (int phase = 0; phase <= SINC_PHASES; phase++) {
+    for (int tap = 0; tap < width; tap++) {
+      double x = tap - half + 1 - (double)phase / SINC_PHASES;
+      double t = M_PI * x * cutoff;
+      double sinc = t == 0.0 ? 1.0 : std::sin(t) / t;
+      double window = std::fabs(x) >= half ? 0.0
+                                           : 0.42 + 0.5 * std::cos(M_PI * x / half) +
+                                                 0.08 * std::cos(2.0 * M_PI * x / half);
+      kernel[phase * width + tap] = (float)(cutoff * sinc * window);
+    }
+  }
+
+  std::vector<float> planar(frameCount + 2 * width + 2, 0.0f);
+  for (ma_uint32 c = 0; c < channels; c++) {
+    for (ma_uint64 f = 0; f < frameCount; f++) planar[half + f] = frames[f * channels + c];
+    for (ma_uint64 f = 0; f < outFrames; f++) {
+      double pos = f / ratio;
+      ma_uint64 index = (ma_uint64)pos;
+      double phase = (pos - index) * SINC_PHASES;
+      int row = std::min((int)phase, SINC_PHASES - 1);
+      float blend = (float)(phase - row);
+
+      const float *in = planar.data() + index + 1; // input frame index - half + 1
+      const float *k0 = kernel.data() + row * width;
+      const float *k1 = k0 + width;
+      float sum0 = 0.0f, sum1 = 0.0f;
+      for (int tap = 0; tap < width; tap++) {
+        sum0 += in[tap] * k0[tap];
+        sum1 += in[tap] * k1[tap];
+      }
+      out[f * channels + c] = sum0 + (sum1 - sum0) * blend;
+    }
+  }
+  return out;
+}
+
+static Pcm resamplePcm(const Pcm &source, double ratio) {
+  Pcm out;
+  out.channels = source.channels;
+  out.frames = resampleFrames(source.frames.data(), source.frameCount, source.channels, ratio);
+  out.frameCount = out.frames.size() / source.channels;
+  return out;
+}
+
+// Decode and convert to the device rate; mono files stay mono, anything else is mapped to
+// the device's channel count
+static bool decodeSample(const std::string &soundFile, ma_uint32 channels,
+                         ma_uint32 sampleRate, Pcm &pcm) {
+  ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 0); // file's rate
+  ma_decoder decoder;
+  bool opened = ma_decoder_init_file(soundFile.c_str(), &config, &decoder) == MA_SUCCESS;
+  if (opened && decoder.outputChannels != 1 && decoder.outputChannels != channels) {
+    ma_decoder_uninit(&decoder);
+    config.channels = channels;
+    opened = ma_decoder_init_file(soundFile.c_str(), &config, &decoder) == MA_SUCCESS;
+  }
+  if (!opened) {
+    std::cerr << "Error loading sound: " << soundFile << std::endl;
+    return false;
+  }
+
+  pcm.channels = decoder.outputChannels;
+  pcm.frameCount = 0;
+  float chunk[4096];
+  ma_uint64 chunkFrames = sizeof(chunk) / sizeof(float) / pcm.channels;
+  ma_uint64 framesRead = 0;
+  while (ma_decoder_read_pcm_frames(&decoder, chunk, chunkFrames, &framesRead) == MA_SUCCESS &&
+         framesRead > 0) {
+    pcm.frames.insert(pcm.frames.end(), chunk, chunk + framesRead * pcm.channels);
+    pcm.frameCount += framesRead;
+  }
+  ma_uint32 fileRate = decoder.outputSampleRate;
+  ma_decoder_uninit(&decoder);
+
+  if (fileRate != sampleRate) pcm = resamplePcm(pcm, (double)sampleRate / fileRate);
+  return true;
+}
+
+// Loudness of a sound as its highest mean square over 10ms windows, so a click isn't judged
+// by its silent tail; also returns its sample peak
+static float shortTermPower(const Pcm &pcm, ma_uint32 sampleRate, float &peak) {
+  size_t window = std::max<size_t>(1, sampleRate * LOUDNESS_WINDOW_MS / 1000) * pcm.channels;
+  float loudest = 0.0f;
+  peak = 0.0f;
+  for (size_t start = 0; start < pcm.frames.size(); start += window) {
+    size_t end = std::min(start + window, pcm.frames.size());
+    float sum = 0.0f, windowPeak = 0.0f;
+    for (size_t i = start; i < end; i++) {
+      sum += pcm.frames[i] * pcm.frames[i];
+      windowPeak = std::max(windowPeak, std::fabs(pcm.frames[i]));
+    }
+    loudest = std::max(loudest, sum / (end - start));
+    peak = std::max(peak, windowPeak);
+  }
+  return loudest;
+}
+
+// One gain for the whole pack, so keys keep their relative levels: brings the median
+// file's short-term loudness to LOUDNESS_TARGET_DB, without pushing any peak past full
+// scale (the stored formats can't hold overs)
+static float normalizationGain(const std::unordered_map<std::string, Pcm> &decoded,
+                               ma_uint32 sampleRate) {
+  std::vector<float> powers;
+  float maxPeak = 0.0f;
+  for (const auto &[file, pcm] : decoded) {
+    float peak;
+    float power = shortTermPower(pcm, sampleRate, peak);
+    if (power > 0.0f) powers.push_back(power);
+    maxPeak = std::max(maxPeak, peak);
+  }
+  if (powers.empty()) return 1.0f;
+
+  std::nth_element(powers.begin(), powers.begin() + powers.size() / 2, powers.end());
+  float medianDb = 10.0f * std::log10(powers[powers.size() / 2]);
+  float gainDb = std::clamp(LOUDNESS_TARGET_DB - medianDb, -LOUDNESS_MAX_GAIN_DB,
+                            LOUDNESS_MAX_GAIN_DB);
+  return std::min(std::pow(10.0f, gainDb / 20.0f), 1.0f / maxPeak);
+}
+
+// Render a copy of the sound played back `pitch` times faster and scaled by `gain`, so
+// variation costs nothing at trigger time
+static Pcm renderVariant(const Pcm &source, float pitch, float gain) {
+  Pcm variant = resamplePcm(source, 1.0 / pitch);
+  for (float &s : variant.frames) s *= gain;
+  return variant;
+}
+
+// Convert to the configured storage format
+static Sample storeSample(const Pcm &pcm) {
+  Sample sample;
+  sample.frameCount = pcm.frameCount;
+  sample.channels = pcm.channels;
+  sample.format = sampleFormat;
+  sample.data.resize(pcm.frames.size() * sampleFormatBytes(sampleFormat));
+
+  if (sampleFormat == SAMPLE_F32) {
+    memcpy(sample.data.data(), pcm.frames.data(), sample.data.size());
+  } else if (sampleFormat == SAMPLE_S16) {
+    int16_t *out = (int16_t *)sample.data.data();
+    for (size_t i = 0; i < pcm.frames.size(); i++) out[i] = floatToS16(pcm.frames[i]);
+  } else {
+    for (size_t i = 0; i < pcm.frames.size(); i++) {
+      sample.data[i] = ulawEncode(floatToS16(pcm.frames[i]));
+    }
+  }
+  return sample;
+}
+
+// A synthesized sound is stored as its description; frameCount is the voice length
+static Sample synthSample(const SynthSound &sound, ma_uint32 sampleRate) {
+  Sample sample;
+  sample.frameCount = (ma_uint64)(sound.lengthMs * sampleRate / 1000.0f);
+  sample.channels = 1;
+  sample.format = SAMPLE_SYNTH;
+  sample.data.resize(sizeof(SynthSound));
+  memcpy(sample.data.data(), &sound, sizeof(sound));
+  return sample;
+}
+
+void sampleMemory(const Soundpack &pack, ma_uint32 channels, size_t &stored,
+                  size_t &expanded) {
+  stored = expanded = 0;
+  for (const auto &sample : pack.samples) {
+    stored += sample->data.size();
+    expanded += sample->frameCount * channels * sizeof(float);
+  }
+}
+
+static void loadRetriggerPolicies(Soundpack &pack, const SoundpackConfig &config,
+                                  ma_uint32 sampleRate) {
+  unsigned short fadeFrames =
+      (unsigned short)std::min(config.fadeMs * sampleRate / 1000.0f, 65535.0f);
+
+  // every key is its own group unless listed in choke_groups
+  for (int keyCode = 0; keyCode < KEY_CNT; keyCode++) {
+    pack.keys[keyCode].retrigger = {(unsigned short)keyCode, config.retrigger,
+                                    (unsigned char)config.maxStack, fadeFrames};
+  }
+
+  for (const ChokeGroup &group : config.chokeGroups) {
+    // name the group after its first valid key so group ids stay below KEY_CNT
+    int groupId = -1;
+    for (int keyCode : group.keys) {
+      if (keyCode < 0 || keyCode >= KEY_CNT) {
+        std::cerr << "Ignoring choke group key with invalid key code: " << keyCode << std::endl;
+        continue;
+      }
+      if (groupId < 0) groupId = keyCode;
+      pack.keys[keyCode].retrigger = {(unsigned short)groupId, group.retrigger,
+                                      (unsigned char)group.maxStack, fadeFrames};
+    }
+  }
+}
+
+// Synth packs: "defines" name sounds of the "synth" table, nothing is decoded
+static void loadSynthSounds(Soundpack &pack, const SoundpackConfig &config,
+                            ma_uint32 sampleRate) {
+  std::unordered_map<std::string, int> loaded;
+  auto sampleIndex = [&](const std::string &name) {
+    auto it = loaded.find(name);
+    if (it != loaded.end()) return it->second;
+    int index = -1;
+    auto sound = config.synthSounds.find(name);
+    if (sound == config.synthSounds.end()) {
+      std::cerr << "Unknown synth sound: " << name << std::endl;
+    } else {
+      index = (int)pack.samples.size();
+      pack.samples.push_back(internSample(synthSample(sound->second, sampleRate)));
+    }
+    loaded.emplace(name, index);
+    return index;
+  };
+
+  const std::vector<std::string> defaultSound = {"default"};
+  bool hasDefault = config.synthSounds.count("default") != 0;
+  for (int keyCode = 1; keyCode < KEY_CNT; keyCode++) {
+    auto defined = config.keySounds.find(keyCode);
+    if (defined == config.keySounds.end() && !hasDefault) continue;
+    const std::vector<std::string> &names =
+        defined != config.keySounds.end() ? defined->second : defaultSound;
+
+    KeySounds &key = pack.keys[keyCode];
+    key.first = (int)pack.variants.size();
+    for (const std::string &name : names) {
+      int index = sampleIndex(name);
+      if (index >= 0) pack.variants.push_back(index);
+    }
+    key.count = (unsigned short)(pack.variants.size() - key.first);
+  }
+
+  if (pack.repeatMode == REPEAT_SAMPLE && !config.repeatSound.empty()) {
+    pack.repeatSample = sampleIndex(config.repeatSound);
+  }
+}
+
+void loadSoundpack(Soundpack &pack, const SoundpackConfig &config,
+                   const std::string &soundpackPath, ma_uint32 channels,
+                   ma_uint32 sampleRate) {
+  pack.path = soundpackPath;
+  pack.channels = channels;
+  pack.sampleRate = sampleRate;
+  pack.sampleFormat = sampleFormat;
+  pack.generation = nextGeneration.fetch_add(1);
+  pack.samples.clear();
+  pack.variants.clear();
+  pack.keys.assign(KEY_CNT, KeySounds{0, 0, 0, {}});
+  pack.randomVariants = config.randomVariants;
+  pack.rngState = config.variantSeed ? config.variantSeed : 1;
+  loadRetriggerPolicies(pack, config, sampleRate);
+
+  pack.repeatMode = config.repeatMode;
+  pack.repeatIntervalNs =
+      config.repeatRate > 0 ? (long long)(1000000000.0f / config.repeatRate) : 0;
+  pack.repeatSample = -1;
+  pack.lastRepeatNs.assign(KEY_CNT, 0);
+
+  if (config.synth) {
+    // voices vary every press themselves, and levels come from the config
+    pack.sampleFormat = SAMPLE_SYNTH;
+    pack.gain = 1.0f;
+    loadSynthSounds(pack, config, sampleRate);
+    return;
+  }
+
+  // decode every file first: normalization looks at the whole pack
+  std::unordered_map<std::string, Pcm> decoded;
+  std::vector<std::string> files;
+  for (const auto &[keyCode, soundFiles] : config.keySounds) {
+    if (keyCode < 0 || keyCode >= KEY_CNT) continue; // not an evdev keycode
+    files.insert(files.end(), soundFiles.begin(), soundFiles.end());
+  }
+  if (pack.repeatMode == REPEAT_SAMPLE && !config.repeatSound.empty()) {
+    files.push_back(config.repeatSound);
+  }
+  for (const std::string &soundFile : files) {
+    if (decoded.count(soundFile)) continue;
+    Pcm pcm;
+    if (decodeSample(soundpackPath + "/" + soundFile, channels, sampleRate, pcm)) {
+      decoded.emplace(soundFile, std::move(pcm));
+    }
+  }
+
+  pack.gain = config.normalize ? normalizationGain(decoded, sampleRate) : 1.0f;
+  if (pack.gain != 1.0f) {
+    for (auto &[file, pcm] : decoded) {
+      for (float &s : pcm.frames) s *= pack.gain;
+    }
+  }
+
+  // a file's decoded sample and rendered variants are contiguous: [first, first + count)
+  std::unordered_map<std::string, std::pair<int, int>> loaded;
+  std::mt19937 rng(config.variantSeed);
+  std::uniform_real_distribution<float> pitchDist(1.0f - config.pitchSpread,
+                                                  1.0f + config.pitchSpread);
+  std::uniform_real_distribution<float> gainDist(1.0f - config.gainSpread, 1.0f);
+
+  for (const auto &[keyCode, soundFiles] : config.keySounds) {
+    if (keyCode < 0 || keyCode >= KEY_CNT) continue; // not an evdev keycode
+
+    KeySounds &key = pack.keys[keyCode];
+    key.first = (int)pack.variants.size();
+
+    for (const std::string &soundFile : soundFiles) {
+      auto it = loaded.find(soundFile);
+      if (it == loaded.end()) {
+        auto pcmIt = decoded.find(soundFile);
+        if (pcmIt == decoded.end()) {
+          it = loaded.emplace(soundFile, std::make_pair(0, 0)).first;
+          continue;
+        }
+        const Pcm &pcm = pcmIt->second;
+        int first = (int)pack.samples.size();
+        pack.samples.push_back(internSample(storeSample(pcm)));
+        for (int v = 0; v < config.pitchVariants; v++) {
+          pack.samples.push_back(internSample(
+              storeSample(renderVariant(pcm, pitchDist(rng), gainDist(rng)))));
+        }
+        it = loaded.emplace(soundFile, std::make_pair(first, 1 + config.pitchVariants))
+                 .first;
+      }
+
+      for (int v = 0; v < it->second.second; v++) {
+        pack.variants.push_back(it->second.first + v);
+      }
+    }
+
+    key.count = (unsigned short)(pack.variants.size() - key.first);
+  }
+
+  if (pack.repeatMode == REPEAT_SAMPLE && decoded.count(config.repeatSound)) {
+    pack.repeatSample = (int)pack.samples.size();
+    pack.samples.push_back(internSample(storeSample(decoded.at(config.repeatSound))));
+  }
+}
+
+bool reloadSoundpackAsync(const std::string &soundpackPath, ma_uint32 channels,
+                          ma_uint32 sampleRate) {
+  if (reloading.exchange(true)) return false;
+
+  std::thread([soundpackPath, channels, sampleRate]() {
+    SoundpackConfig config;
+    if (loadSoundpackConfig(soundpackPath + "/config.json", config)) {
+      Soundpack *pack = new Soundpack;
+      loadSoundpack(*pack, config, soundpackPath, channels, sampleRate);
+      // a pack that was never adopted is simply replaced
+      delete pendingSoundpack.exchange(pack, std::memory_order_acq_rel);
+    } else {
+      std::cerr << "Reload failed, keeping the current soundpack." << std::endl;
+    }
+    reloading.store(false);
+  }).detach();
+
+  return true;
+}
+
+Soundpack *takePendingSoundpack() {
+  if (!pendingSoundpack.load(std::memory_order_relaxed)) return nullptr;
+  return pendingSoundpack.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+const Sample *pickSample(Soundpack &pack, unsigned keyCode, int value, long long timeNs) {
+  if (keyCode >= pack.keys.size()) return nullptr;
+  KeySounds &key = pack.keys[keyCode];
+  if (key.count == 0) return nullptr;
+
+  if (value == 2) {
+    if (pack.repeatMode == REPEAT_IGNORE) return nullptr;
+    if (timeNs - pack.lastRepeatNs[keyCode] < pack.repeatIntervalNs) return nullptr;
+    pack.lastRepeatNs[keyCode] = timeNs;
+    if (pack.repeatMode == REPEAT_SAMPLE) {
+      return pack.repeatSample >= 0 ? pack.samples[pack.repeatSample].get() : nullptr;
+    }
+  } else if (value != 1) {
+    return nullptr;
+  } else {
+    // a fresh press restarts the repeat throttle
+    pack.lastRepeatNs[keyCode] = timeNs;
+  }
+
+  unsigned pick = 0;
+  if (key.count > 1) {
+    if (pack.randomVariants) {
+      // xorshift32, seeded from the config so runs are reproducible
+      unsigned x = pack.rngState;
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      pack.rngState = x;
+      pick = x % key.count;
+    } else {
+      pick = key.next;
+      key.next = (unsigned short)((key.next + 1) % key.count);
+    }
+  }
+
+  return pack.samples[pack.variants[key.first + pick]].get();
+}
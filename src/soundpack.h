@@ -0,0 +1,95 @@
+#ifndef SOUNDPACK_H
+#define SOUNDPACK_H
+
+#include "config.h"
+#include "miniaudio.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// How decoded samples are kept in memory; the mixer expands s16 and µ-law on the fly and
+// renders synthesized sounds (data holds a SynthSound) per voice
+enum SampleFormat { SAMPLE_F32, SAMPLE_S16, SAMPLE_ULAW, SAMPLE_SYNTH };
+
+// Decoded sound at the playback device's rate: mono, or interleaved with the device's
+// channel count
+struct Sample {
+  std::vector<unsigned char> data; // frameCount * channels values in `format`
+  ma_uint64 frameCount;
+  ma_uint32 channels;
+  SampleFormat format;
+};
+
+// Voice policy carried with every trigger
+struct Retrigger {
+  unsigned short group; // keys sharing a group cut each other's voices
+  RetriggerMode mode;
+  unsigned char maxStack;    // 0 = unlimited
+  unsigned short fadeFrames; // choke fade length
+};
+
+// Range of a key's variants in Soundpack::variants
+struct KeySounds {
+  int first;
+  unsigned short count;
+  unsigned short next; // round-robin cursor
+  Retrigger retrigger;
+};
+
+// Preloaded sample bank plus the keycode dispatch table
+struct Soundpack {
+  std::vector<std::shared_ptr<const Sample>> samples; // interned, see samplebank.h
+  std::vector<KeySounds> keys; // indexed by keycode, KEY_CNT entries
+  std::vector<int> variants;   // sample indices, grouped per key
+  bool randomVariants;
+  unsigned rngState;
+
+  RepeatMode repeatMode;
+  long long repeatIntervalNs;
+  int repeatSample;                   // -1 = none
+  std::vector<long long> lastRepeatNs; // indexed by keycode
+
+  ma_uint32 channels; // device format the samples were converted to
+  ma_uint32 sampleRate;
+  SampleFormat sampleFormat;
+  float gain; // loudness normalization baked into the samples
+  std::string path;
+  unsigned generation; // increases with every load, lets the mixer report what it still uses
+};
+
+size_t sampleFormatBytes(SampleFormat format);
+
+// Band-limited resampling of interleaved f32 frames by ratio = output rate / input rate
+std::vector<float> resampleFrames(const float *frames, ma_uint64 frameCount,
+                                  ma_uint32 channels, double ratio);
+
+// G.711 µ-law value as f32
+float ulawToFloat(unsigned char ulaw);
+
+// Storage format for soundpacks loaded from now on (default f32)
+void setSampleFormat(SampleFormat format);
+SampleFormat getSampleFormat();
+
+// Bytes the pack's samples take, and what interleaved f32 in `channels` would take
+void sampleMemory(const Soundpack &pack, ma_uint32 channels, size_t &stored,
+                  size_t &expanded);
+
+// Decode every sound of the soundpack once, rendering the configured pitch/gain
+// variants, and convert it to the given playback format so the mixer only copies and adds
+void loadSoundpack(Soundpack &pack, const SoundpackConfig &config,
+                   const std::string &soundpackPath, ma_uint32 channels,
+                   ma_uint32 sampleRate);
+
+// Load a soundpack on a background thread without touching the one in use; the input loop
+// adopts it through takePendingSoundpack(). Returns false if a reload is already running.
+bool reloadSoundpackAsync(const std::string &soundpackPath, ma_uint32 channels,
+                          ma_uint32 sampleRate);
+
+// The soundpack finished by the last reload, or nullptr; ownership passes to the caller
+Soundpack *takePendingSoundpack();
+
+// Pick the sample to play for a key event (value 1 = press, 2 = auto-repeat), nullptr if
+// the event should stay silent
+const Sample *pickSample(Soundpack &pack, unsigned keyCode, int value, long long timeNs);
+
+#endif // SOUNDPACK_H
@@ -0,0 +1,91 @@
+#include "stats.h"
+#include "audio.h"
+#include "governor.h"
+#include <iomanip>
+#include <sstream>
+
+Stats stats;
+
+void recordLatency(long long latencyNs) {
+  long long bucket = latencyNs / (LATENCY_BUCKET_US * 1000);
+  if (bucket < 0) bucket = 0;
+  if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+  count(stats.latencyBuckets[bucket]);
+  if (latencyNs > 0) count(stats.latencySumNs, latencyNs);
+}
+
+void recordCallbackTime(long long durationNs) {
+  int bucket = 0;
+  while (bucket < CALLBACK_BUCKETS - 1 &&
+         durationNs > (long long)CALLBACK_BUCKET_US * 1000 << bucket) {
+    bucket++;
+  }
+  count(stats.callbackBuckets[bucket]);
+  count(stats.callbacks);
+  count(stats.callbackTimeNs, durationNs);
+}
+
+unsigned latencyPercentileUs(double percentile) {
+  unsigned long counts[LATENCY_BUCKETS];
+  unsigned long total = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    counts[i] = stats.latencyBuckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) return 0;
+
+  unsigned long rank = (unsigned long)(total * percentile / 100.0);
+  unsigned long seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen > rank) return (i + 1) * LATENCY_BUCKET_US; // bucket upper bound
+  }
+  return LATENCY_BUCKETS * LATENCY_BUCKET_US;
+}
+
+void printStats(std::ostream &out) {
+  auto get = [](const std::atomic<unsigned long> &counter) {
+    return counter.load(std::memory_order_relaxed);
+  };
+
+  out << "events read:        " << get(stats.eventsRead) << "\n"
+      << "triggers:           " << get(stats.triggers) << "\n"
+      << "triggers dropped:   " << get(stats.triggersDropped) << "\n"
+      << "duplicates dropped: " << get(stats.duplicatesDropped) << "\n"
+      << "injected dropped:   " << get(stats.injectDropped) << "\n"
+      << "late triggers:      " << get(stats.lateTriggers) << "\n"
+      << "voice steals:       " << get(stats.voiceSteals) << "\n"
+      << "limited frames:     " << get(stats.limitedFrames) << "\n"
+      << "reloads:            " << get(stats.reloads) << "\n"
+      << "active voices:      " << get(stats.activeVoices) << "\n"
+      << "latency p50/p99:    " << latencyPercentileUs(50) << "/" << latencyPercentileUs(99)
+      << " us\n";
+
+  unsigned long voiceTimeNs = get(stats.voiceTimeNs);
+  std::ostringstream mixCpu;
+  mixCpu << std::fixed << std::setprecision(4)
+         << (voiceTimeNs ? 100.0 * get(stats.mixTimeNs) / voiceTimeNs : 0.0);
+  out << "sample memory:      " << get(stats.sampleBytes) / 1024 << " KiB (f32: "
+      << get(stats.sampleBytesF32) / 1024 << " KiB)\n";
+
+  std::ostringstream callbackLoad;
+  callbackLoad << std::fixed << std::setprecision(1) << get(stats.callbackLoadPermille) / 10.0;
+
+  unsigned long bankStored = get(stats.bankStoredBytes);
+  std::ostringstream dedupRatio;
+  dedupRatio << std::fixed << std::setprecision(2)
+             << (bankStored ? (double)get(stats.bankReferencedBytes) / bankStored : 1.0);
+  out << "sample bank:        " << bankStored / 1024 << " KiB for "
+      << get(stats.bankReferencedBytes) / 1024 << " KiB of samples (dedup "
+      << dedupRatio.str() << "x)\n"
+      << "mix cpu per voice:  " << mixCpu.str() << "% of a core\n"
+      << "mixer:              " << (integerMixing() ? "s16 fixed point" : "f32") << "\n"
+      << "callback load:      " << callbackLoad.str() << "% of the period\n"
+      << "overruns:           " << get(stats.overruns) << " (last with "
+      << get(stats.overrunVoices) << " voices)\n"
+      << "xruns:              " << get(stats.xruns) << "\n"
+      << "voice cap:          " << get(stats.voiceCap) << "\n"
+      << "governor level:     " << get(stats.governorLevel) << " ("
+      << governorLevelName((int)get(stats.governorLevel)) << ", "
+      << get(stats.governorChanges) << " changes)" << std::endl;
+}
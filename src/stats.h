@@ -0,0 +1,80 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <ostream>
+
+#define LATENCY_BUCKETS 500 // 100us each, the last one collects everything above 50ms
+#define LATENCY_BUCKET_US 100
+#define CALLBACK_BUCKETS 12 // audio callback duration: 25us doubling up to 25.6ms, then above
+#define CALLBACK_BUCKET_US 25
+#define STATS_DEVICES 16 // input devices counted separately, by poll index
+
+// Runtime counters. Each one has a single writing thread, the input loop or the audio
+// callback, so they are bumped with count(): wait-free, without a locked instruction. The
+// two groups live on separate cache lines; readers only aggregate when they print or export.
+struct Stats {
+  // written by the input loop
+  alignas(64) std::atomic<unsigned long> eventsRead{0};
+  std::atomic<unsigned long> deviceEvents[STATS_DEVICES] = {};
+  std::atomic<unsigned long> triggers{0};
+  std::atomic<unsigned long> triggersDropped{0};   // trigger queue was full
+  std::atomic<unsigned long> duplicatesDropped{0}; // same press from another device
+  std::atomic<unsigned long> injectDropped{0};     // records past an injector datagram's cap
+  std::atomic<unsigned long> reloads{0};
+
+  // current soundpack's samples as stored, and as interleaved f32 would take
+  std::atomic<unsigned long> sampleBytes{0};
+  std::atomic<unsigned long> sampleBytesF32{0};
+
+  // all loaded soundpacks' samples, before and after deduplication
+  std::atomic<unsigned long> bankReferencedBytes{0};
+  std::atomic<unsigned long> bankStoredBytes{0};
+
+  // load governor, see governor.h
+  std::atomic<unsigned long> governorLevel{0};
+  std::atomic<unsigned long> governorChanges{0};
+
+  // written by the audio callback
+  alignas(64) std::atomic<unsigned long> lateTriggers{0}; // missed their scheduled start frame
+  std::atomic<unsigned long> voiceSteals{0};
+  std::atomic<unsigned long> limitedFrames{0}; // output frames the master limiter reduced
+  std::atomic<unsigned long> activeVoices{0};  // after the last audio period
+
+  // mixer CPU time against the playing time of the voices it mixed
+  std::atomic<unsigned long> mixTimeNs{0};
+  std::atomic<unsigned long> voiceTimeNs{0};
+
+  // callback deadline watchdog
+  std::atomic<unsigned long> xruns{0};    // device ran dry: late callback or interruption
+  std::atomic<unsigned long> overruns{0}; // callback took longer than its period
+  std::atomic<unsigned long> overrunVoices{0};        // playing during the last overrun
+  std::atomic<unsigned long> callbackLoadPermille{0}; // rolling duration / period
+  std::atomic<unsigned long> voiceCap{0};             // voices allowed, see setVoiceShedding()
+
+  // whole callback duration
+  std::atomic<unsigned long> callbacks{0};
+  std::atomic<unsigned long> callbackTimeNs{0};
+  std::atomic<unsigned long> callbackBuckets[CALLBACK_BUCKETS] = {};
+
+  // key event -> first output frame of its voice
+  std::atomic<unsigned long> latencySumNs{0};
+  std::atomic<unsigned long> latencyBuckets[LATENCY_BUCKETS] = {};
+};
+
+extern Stats stats;
+
+// Bump a counter from its writing thread
+inline void count(std::atomic<unsigned long> &counter, unsigned long n = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void recordLatency(long long latencyNs);
+void recordCallbackTime(long long durationNs);
+
+// Trigger latency at the given percentile (0-100) in microseconds, 0 without samples
+unsigned latencyPercentileUs(double percentile);
+
+void printStats(std::ostream &out);
+
+#endif // STATS_H
@@ -0,0 +1,154 @@
+#include "status.h"
+#include "stats.h"
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATUS_UPDATE_INTERVAL_NS 100000000LL
+
+static StatusPage *page = nullptr;
+static long long lastUpdateNs = 0;
+
+static long long monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+std::string statusPageName() { return "/wayvibes-" + std::to_string(getuid()); }
+
+bool openStatusPage() {
+  // owner only: the counters would tell other users when keys are typed
+  int fd = shm_open(statusPageName().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  struct stat st;
+  if (fd >= 0 && (fstat(fd, &st) < 0 || st.st_uid != geteuid())) {
+    std::cerr << "Status page /dev/shm" << statusPageName() << " belongs to another user"
+              << std::endl;
+    close(fd);
+    return false;
+  }
+  // a page left by an older version may be readable by others
+  if (fd < 0 || fchmod(fd, 0600) < 0 || ftruncate(fd, sizeof(StatusPage)) < 0) {
+    std::cerr << "Failed to create status page /dev/shm" << statusPageName() << std::endl;
+    if (fd >= 0) close(fd);
+    return false;
+  }
+
+  void *mapped = mmap(NULL, sizeof(StatusPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return false;
+
+  page = new (mapped) StatusPage();
+  page->version = STATUS_PAGE_VERSION;
+  page->size = sizeof(StatusPage);
+  page->pid = getpid();
+  return true;
+}
+
+void closeStatusPage() {
+  if (!page) return;
+  munmap(page, sizeof(StatusPage));
+  shm_unlink(statusPageName().c_str());
+  page = nullptr;
+}
+
+void updateStatusPage(const std::string &pack, float volume, bool muted) {
+  if (!page) return;
+  long long now = monotonicNs();
+  if (now - lastUpdateNs < STATUS_UPDATE_INTERVAL_NS) return;
+  lastUpdateNs = now;
+
+  auto get = [](const std::atomic<unsigned long> &counter) {
+    return (uint64_t)counter.load(std::memory_order_relaxed);
+  };
+
+  // computed before entering the write section to keep it short
+  uint32_t p50 = latencyPercentileUs(50);
+  uint32_t p90 = latencyPercentileUs(90);
+  uint32_t p99 = latencyPercentileUs(99);
+
+  // seqlock write: odd while fields change; single writer, so no lock is needed
+  uint32_t sequence = page->sequence.load(std::memory_order_relaxed);
+  page->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  strncpy(page->pack, pack.c_str(), sizeof(page->pack) - 1);
+  page->pack[sizeof(page->pack) - 1] = '\0';
+  page->volume = volume;
+  page->muted = muted;
+  page->eventsRead = get(stats.eventsRead);
+  page->triggers = get(stats.triggers);
+  page->triggersDropped = get(stats.triggersDropped);
+  page->duplicatesDropped = get(stats.duplicatesDropped);
+  page->lateTriggers = get(stats.lateTriggers);
+  page->voiceSteals = get(stats.voiceSteals);
+  page->reloads = get(stats.reloads);
+  page->activeVoices = (uint32_t)get(stats.activeVoices);
+  page->latencyP50Us = p50;
+  page->latencyP90Us = p90;
+  page->latencyP99Us = p99;
+  page->xruns = get(stats.xruns);
+  page->overruns = get(stats.overruns);
+  page->callbackLoadPermille = (uint32_t)get(stats.callbackLoadPermille);
+  page->updatedNs = now;
+
+  page->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+int printStatusPage() {
+  int fd = shm_open(statusPageName().c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) {
+    std::cerr << "wayvibes is not running (no /dev/shm" << statusPageName() << ")"
+              << std::endl;
+    return 1;
+  }
+  void *mapped = mmap(NULL, sizeof(StatusPage), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return 1;
+  const StatusPage *shared = (const StatusPage *)mapped;
+
+  if (shared->version != STATUS_PAGE_VERSION || shared->size != sizeof(StatusPage)) {
+    std::cerr << "Status page version mismatch, is wayvibes up to date?" << std::endl;
+    munmap(mapped, sizeof(StatusPage));
+    return 1;
+  }
+
+  // seqlock read: copy field by field so a concurrent write can't tear the snapshot
+  StatusPage snapshot;
+  uint32_t before, after;
+  do {
+    before = shared->sequence.load(std::memory_order_acquire);
+    if (before & 1) continue;
+    memcpy(snapshot.pack, (const char *)shared->pack, sizeof(snapshot.pack));
+    snapshot.volume = shared->volume;
+    snapshot.muted = shared->muted;
+    snapshot.triggers = shared->triggers;
+    snapshot.duplicatesDropped = shared->duplicatesDropped;
+    snapshot.activeVoices = shared->activeVoices;
+    snapshot.latencyP50Us = shared->latencyP50Us;
+    snapshot.latencyP99Us = shared->latencyP99Us;
+    snapshot.xruns = shared->xruns;
+    snapshot.callbackLoadPermille = shared->callbackLoadPermille;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = shared->sequence.load(std::memory_order_relaxed);
+  } while ((before & 1) || before != after);
+  munmap(mapped, sizeof(StatusPage));
+
+  snapshot.pack[sizeof(snapshot.pack) - 1] = '\0';
+  std::cout << "pack: " << snapshot.pack << "\n"
+            << "volume: " << snapshot.volume << "\n"
+            << "muted: " << (snapshot.muted ? "yes" : "no") << "\n"
+            << "triggers: " << snapshot.triggers << "\n"
+            << "duplicates dropped: " << snapshot.duplicatesDropped << "\n"
+            << "active voices: " << snapshot.activeVoices << "\n"
+            << "latency p50/p99: " << snapshot.latencyP50Us << "/" << snapshot.latencyP99Us
+            << " us\n"
+            << "xruns: " << snapshot.xruns << "\n"
+            << "audio load: " << snapshot.callbackLoadPermille / 10.0 << "%" << std::endl;
+  return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define STATUS_PAGE_VERSION 2
+
+// Status page published in /dev/shm/wayvibes-<uid> (mode 0600) for status bars. Readers mmap it and
+// take a consistent snapshot without syscalls: read `sequence`, skip if odd, copy the
+// fields, then read `sequence` again and retry if it changed.
+struct StatusPage {
+  uint32_t version; // STATUS_PAGE_VERSION, set once
+  uint32_t size;    // sizeof(StatusPage), set once
+  std::atomic<uint32_t> sequence;
+  int32_t pid;
+
+  char pack[256];
+  float volume;
+  uint32_t muted;
+
+  uint64_t eventsRead;
+  uint64_t triggers;
+  uint64_t triggersDropped;
+  uint64_t duplicatesDropped;
+  uint64_t lateTriggers;
+  uint64_t voiceSteals;
+  uint64_t reloads;
+  uint32_t activeVoices;
+
+  uint32_t latencyP50Us;
+  uint32_t latencyP90Us;
+  uint32_t latencyP99Us;
+
+  uint64_t xruns;
+  uint64_t overruns;
+  uint32_t callbackLoadPermille; // rolling audio callback duration / period
+
+  uint64_t updatedNs; // CLOCK_MONOTONIC time of the last update
+};
+
+// Name of the shared memory object, for shm_open()
+std::string statusPageName();
+
+// Create the page; the daemon is its only writer
+bool openStatusPage();
+void closeStatusPage();
+
+// Publish the current state, at most every 100ms; called from the daemon loop
+void updateStatusPage(const std::string &pack, float volume, bool muted);
+
+// `wayvibes status`: print a snapshot of the running daemon's page
+int printStatusPage();
+
+#endif // STATUS_H
@@ -0,0 +1,193 @@
+#include "synth.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define LN_1000 6.9077553f     // a 60 dB decay, as a natural log
+#define NOISE_FLOOR 0.0001f    // the burst is dropped below -80 dB
+#define MODE_FLOOR 0.00001f    // modes are dropped below -100 dB, before they turn denormal
+#define MAX_MODE_NYQUIST 0.45f // modes above this share of the rate are left out
+
+SynthSound defaultSynthSound() {
+  SynthSound sound = {};
+  sound.pitch = 1800.0f;
+  sound.lengthMs = 90.0f;
+  sound.level = 0.5f;
+  // a plate's first partials, the higher ones dying faster
+  const float modes[][3] = {{1.0f, 1.0f, 60.0f}, {2.32f, 0.6f, 35.0f},
+                            {4.25f, 0.35f, 20.0f}, {6.63f, 0.2f, 12.0f}};
+  for (const auto &mode : modes) {
+    sound.modeRatio[sound.modeCount] = mode[0];
+    sound.modeGain[sound.modeCount] = mode[1];
+    sound.modeDecayMs[sound.modeCount] = mode[2];
+    sound.modeCount++;
+  }
+  sound.noise = 0.8f;
+  sound.noiseTone = 0.6f;
+  sound.noiseDecayMs = 6.0f;
+  sound.pitchSpread = 0.03f;
+  sound.levelSpread = 0.15f;
+  sound.decaySpread = 0.1f;
+  return sound;
+}
+
+static unsigned xorshift(unsigned &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Uniform in [-1, 1)
+static float spread(unsigned &state) {
+  return (float)(xorshift(state) >> 8) / 8388608.0f - 1.0f;
+}
+
+// Per-frame factor of a 60 dB decay over decayMs
+static double decayPerFrame(float decayMs, unsigned sampleRate) {
+  return std::exp(-LN_1000 / (std::max(decayMs, 0.1f) * 0.001 * sampleRate));
+}
+
+void startSynthVoice(SynthVoice &voice, const SynthSound &sound, unsigned sampleRate,
+                     unsigned seed) {
+  unsigned rng = seed ? seed : 1;
+  xorshift(rng); // consecutive seeds start far apart
+  float pitch = sound.pitch * (1.0f + spread(rng) * sound.pitchSpread);
+  float level = sound.level * (1.0f - (spread(rng) * 0.5f + 0.5f) * sound.levelSpread);
+
+  // gains are relative: the modes together peak at `level`
+  float gainSum = 0.0f;
+  for (unsigned m = 0; m < sound.modeCount && m < SYNTH_MODES; m++) {
+    gainSum += std::fabs(sound.modeGain[m]);
+  }
+  float gainScale = gainSum > 0.0f ? level / gainSum : 0.0f;
+
+  voice.modeCount = 0;
+  for (unsigned m = 0; m < sound.modeCount && m < SYNTH_MODES; m++) {
+    // each resonance drifts a little on its own, as on a real board
+    double frequency =
+        pitch * sound.modeRatio[m] * (1.0f + spread(rng) * sound.pitchSpread * 0.25f);
+    float decayMs = sound.modeDecayMs[m] * (1.0f + spread(rng) * sound.decaySpread);
+    if (frequency <= 0.0 || frequency >= MAX_MODE_NYQUIST * sampleRate) continue;
+
+    double omega = 2.0 * M_PI * frequency / sampleRate;
+    double radius = decayPerFrame(decayMs, sampleRate);
+    unsigned v = voice.modeCount++;
+    voice.re[v] = sound.modeGain[m] * gainScale;
+    voice.im[v] = 0.0f; // starts at zero crossing; the noise makes the attack
+    voice.stepRe[v] = (float)(radius * std::cos(omega));
+    voice.stepIm[v] = (float)(radius * std::sin(omega));
+    double radius4 = radius * radius * radius * radius;
+    voice.step4Re[v] = (float)(radius4 * std::cos(4.0 * omega));
+    voice.step4Im[v] = (float)(radius4 * std::sin(4.0 * omega));
+  }
+
+  voice.noiseLevel = sound.noise * level;
+  voice.noiseDecay = (float)decayPerFrame(
+      sound.noiseDecayMs * (1.0f + spread(rng) * sound.decaySpread), sampleRate);
+  voice.noiseTone = std::clamp(sound.noiseTone * (1.0f + spread(rng) * sound.decaySpread),
+                               0.01f, 1.0f);
+  voice.noiseState = 0.0f;
+  voice.rng = rng;
+}
+
+// Add one mode to `out`. The recursion is serial in time, so four consecutive frames are
+// run side by side, each lane stepping four frames at a time.
+static void addMode(float &re, float &im, float stepRe, float stepIm, float step4Re,
+                    float step4Im, float *out, unsigned frames) {
+  unsigned i = 0;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  if (frames >= 4) {
+    float laneRe[4] = {re}, laneIm[4] = {im};
+    for (int j = 1; j < 4; j++) {
+      laneRe[j] = laneRe[j - 1] * stepRe - laneIm[j - 1] * stepIm;
+      laneIm[j] = laneRe[j - 1] * stepIm + laneIm[j - 1] * stepRe;
+    }
+#if defined(__SSE2__)
+    __m128 zr = _mm_loadu_ps(laneRe), zi = _mm_loadu_ps(laneIm);
+    const __m128 sr = _mm_set1_ps(step4Re), si = _mm_set1_ps(step4Im);
+    if (frames >= 8) {
+      // a second set of lanes four frames ahead hides the latency of the multiplies
+      __m128 wr = _mm_sub_ps(_mm_mul_ps(zr, sr), _mm_mul_ps(zi, si));
+      __m128 wi = _mm_add_ps(_mm_mul_ps(zr, si), _mm_mul_ps(zi, sr));
+      const __m128 s8r = _mm_set1_ps(step4Re * step4Re - step4Im * step4Im);
+      const __m128 s8i = _mm_set1_ps(2.0f * step4Re * step4Im);
+      for (; i + 8 <= frames; i += 8) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), zi));
+        _mm_storeu_ps(out + i + 4, _mm_add_ps(_mm_loadu_ps(out + i + 4), wi));
+        __m128 nextRe = _mm_sub_ps(_mm_mul_ps(zr, s8r), _mm_mul_ps(zi, s8i));
+        zi = _mm_add_ps(_mm_mul_ps(zr, s8i), _mm_mul_ps(zi, s8r));
+        zr = nextRe;
+        nextRe = _mm_sub_ps(_mm_mul_ps(wr, s8r), _mm_mul_ps(wi, s8i));
+        wi = _mm_add_ps(_mm_mul_ps(wr, s8i), _mm_mul_ps(wi, s8r));
+        wr = nextRe;
+      }
+    }
+    for (; i + 4 <= frames; i += 4) {
+      _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), zi));
+      __m128 nextRe = _mm_sub_ps(_mm_mul_ps(zr, sr), _mm_mul_ps(zi, si));
+      zi = _mm_add_ps(_mm_mul_ps(zr, si), _mm_mul_ps(zi, sr));
+      zr = nextRe;
+    }
+    _mm_storeu_ps(laneRe, zr);
+    _mm_storeu_ps(laneIm, zi);
+#else
+    float32x4_t zr = vld1q_f32(laneRe), zi = vld1q_f32(laneIm);
+    for (; i + 4 <= frames; i += 4) {
+      vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), zi));
+      float32x4_t nextRe = vmlsq_n_f32(vmulq_n_f32(zr, step4Re), zi, step4Im);
+      zi = vmlaq_n_f32(vmulq_n_f32(zr, step4Im), zi, step4Re);
+      zr = nextRe;
+    }
+    vst1q_f32(laneRe, zr);
+    vst1q_f32(laneIm, zi);
+#endif
+    re = laneRe[0];
+    im = laneIm[0];
+  }
+#else
+  (void)step4Re;
+  (void)step4Im;
+#endif
+  for (; i < frames; i++) {
+    out[i] += im;
+    float nextRe = re * stepRe - im * stepIm;
+    im = re * stepIm + im * stepRe;
+    re = nextRe;
+  }
+}
+
+void renderSynth(SynthVoice &voice, float *out, unsigned frames) {
+  memset(out, 0, frames * sizeof(float));
+  for (unsigned m = 0; m < voice.modeCount;) {
+    addMode(voice.re[m], voice.im[m], voice.stepRe[m], voice.stepIm[m], voice.step4Re[m],
+            voice.step4Im[m], out, frames);
+    if (std::fabs(voice.re[m]) + std::fabs(voice.im[m]) >= MODE_FLOOR) {
+      m++;
+      continue;
+    }
+    unsigned last = --voice.modeCount; // order doesn't matter, the modes are summed
+    voice.re[m] = voice.re[last];
+    voice.im[m] = voice.im[last];
+    voice.stepRe[m] = voice.stepRe[last];
+    voice.stepIm[m] = voice.stepIm[last];
+    voice.step4Re[m] = voice.step4Re[last];
+    voice.step4Im[m] = voice.step4Im[last];
+  }
+
+  // the burst lasts a few milliseconds of the voice, so it can afford a serial filter
+  if (voice.noiseLevel == 0.0f) return;
+  float level = voice.noiseLevel, state = voice.noiseState;
+  for (unsigned i = 0; i < frames && level >= NOISE_FLOOR; i++) {
+    state += voice.noiseTone * (spread(voice.rng) - state);
+    out[i] += state * level;
+    level *= voice.noiseDecay;
+  }
+  voice.noiseLevel = level >= NOISE_FLOOR ? level : 0.0f;
+  voice.noiseState = state;
+}
@@ -0,0 +1,55 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+// Procedural key sounds for soundpacks with "type": "synth". A sound is a small modal model:
+// a few exponentially decaying sinusoids (the resonances of keycap, plate and case) excited
+// by a short burst of filtered noise (the contact). Nothing is decoded or stored; voices
+// render the model in the mixer at a fixed cost per mode and frame, with pitch, decays,
+// level and noise color varied slightly on every press.
+
+#define SYNTH_MODES 8
+
+// One sound as described under "synth" in config.json. Stored as the bytes of a Sample in
+// the SAMPLE_SYNTH format, so it must stay plain data.
+struct SynthSound {
+  float pitch;    // "pitch": Hz of a mode with ratio 1
+  float lengthMs; // "length_ms": voice length
+  float level;    // "level": peak level of the modes
+  unsigned modeCount;
+  float modeRatio[SYNTH_MODES];   // "modes": [[ratio, gain, decay_ms], ...], frequency
+  float modeGain[SYNTH_MODES];    // relative to the other modes
+  float modeDecayMs[SYNTH_MODES]; // time to fall by 60 dB
+  float noise;        // "noise": level of the noise burst relative to `level`
+  float noiseTone;    // "noise_tone": 0 = dark, 1 = white
+  float noiseDecayMs; // "noise_decay_ms": time to fall by 60 dB
+  // per press, from the pack's "pitch_spread", "gain_spread" and "decay_spread"
+  float pitchSpread;
+  float levelSpread;
+  float decaySpread;
+};
+
+// Playback state of one synthesized voice; every mode is a rotating, shrinking phasor whose
+// imaginary part is its output
+struct SynthVoice {
+  float re[SYNTH_MODES], im[SYNTH_MODES];
+  float stepRe[SYNTH_MODES], stepIm[SYNTH_MODES];   // one frame
+  float step4Re[SYNTH_MODES], step4Im[SYNTH_MODES]; // four frames
+  unsigned modeCount;
+  unsigned rng;
+  float noiseLevel; // 0 once the burst has died away
+  float noiseDecay; // per frame
+  float noiseTone;
+  float noiseState; // one-pole low-pass
+};
+
+// The built-in sound: a short, bright click with a damped body
+SynthSound defaultSynthSound();
+
+// Set up a voice for one press; `seed` picks its variation
+void startSynthVoice(SynthVoice &voice, const SynthSound &sound, unsigned sampleRate,
+                     unsigned seed);
+
+// Write the voice's next `frames` mono frames to `out`
+void renderSynth(SynthVoice &voice, float *out, unsigned frames);
+
+#endif // SYNTH_H
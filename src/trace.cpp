@@ -0,0 +1,197 @@
+#include "trace.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_RINGS 8         // threads recording at once; others wait for a free ring
+#define TRACE_RING_SIZE 16384 // records per thread, must be a power of two
+#define TRACE_FLUSH_MS 100
+
+struct TraceRecord {
+  long long timeNs;
+  const char *name;
+  const char *argName;
+  long long arg;
+  unsigned long long flowId;
+  TracePhase phase;
+};
+
+// Single producer (the owning thread) / single consumer (the writer) record ring
+struct TraceRing {
+  std::atomic<bool> claimed{false};
+  std::atomic<bool> exited{false}; // owner is gone; freed once the writer has drained it
+  pid_t tid = 0;
+  char threadName[16] = "";
+  bool named = false; // thread name written to the current trace
+  std::atomic<unsigned> head{0};
+  std::atomic<unsigned> tail{0};
+  std::atomic<unsigned long> dropped{0}; // ring was full
+  TraceRecord records[TRACE_RING_SIZE];
+};
+
+std::atomic<bool> traceEnabled{false};
+
+// Allocated by the first startTrace() and kept, threads hold on to their ring
+static std::atomic<TraceRing *> rings{nullptr};
+static thread_local TraceRing *threadRing = nullptr;
+
+static std::mutex writerMutex;
+static std::condition_variable writerWake;
+static std::thread writer;
+static bool writerStop = false;
+static FILE *traceFile = nullptr;
+static std::string tracePath;
+static bool firstRecord = true;
+
+static long long monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Hands the ring back when its thread exits, so threads that come and go (reloads, reopened
+// audio devices) don't use up the pool
+struct RingRelease {
+  ~RingRelease() {
+    if (threadRing) threadRing->exited.store(true, std::memory_order_release);
+    threadRing = nullptr;
+  }
+};
+
+static TraceRing *claimRing() {
+  TraceRing *pool = rings.load(std::memory_order_acquire);
+  for (int i = 0; pool && i < TRACE_RINGS; i++) {
+    bool expected = false;
+    if (pool[i].claimed.compare_exchange_strong(expected, true)) {
+      pool[i].tid = (pid_t)syscall(SYS_gettid);
+      pthread_getname_np(pthread_self(), pool[i].threadName, sizeof(pool[i].threadName));
+      static thread_local RingRelease release;
+      (void)release;
+      return &pool[i];
+    }
+  }
+  return nullptr;
+}
+
+void recordTrace(TracePhase phase, const char *name, const char *argName, long long arg,
+                 unsigned long long flowId) {
+  TraceRing *ring = threadRing;
+  if (!ring && !(ring = threadRing = claimRing())) return;
+
+  unsigned head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) >= TRACE_RING_SIZE) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ring->records[head & (TRACE_RING_SIZE - 1)] = {monotonicNs(), name, argName, arg, flowId,
+                                                 phase};
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+// One Chrome trace event; timestamps are CLOCK_MONOTONIC in microseconds
+static void writeRecord(const TraceRing &ring, const TraceRecord &record) {
+  fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d",
+          firstRecord ? "" : ",\n", record.name, (char)record.phase, record.timeNs / 1000,
+          record.timeNs % 1000, (int)getpid(), (int)ring.tid);
+  firstRecord = false;
+  if (record.phase == TRACE_INSTANT) fputs(",\"s\":\"t\"", traceFile);
+  if (record.phase == TRACE_FLOW_START || record.phase == TRACE_FLOW_END) {
+    // bound to the enclosing slice: dispatch on the input thread, the callback on the other
+    fprintf(traceFile, ",\"cat\":\"key\",\"id\":%llu%s", record.flowId,
+            record.phase == TRACE_FLOW_END ? ",\"bp\":\"e\"" : "");
+  }
+  if (record.argName) fprintf(traceFile, ",\"args\":{\"%s\":%lld}", record.argName, record.arg);
+  fputc('}', traceFile);
+}
+
+static void drainRings() {
+  TraceRing *pool = rings.load(std::memory_order_acquire);
+  for (int i = 0; i < TRACE_RINGS; i++) {
+    TraceRing &ring = pool[i];
+    if (!ring.claimed.load(std::memory_order_acquire)) continue;
+    unsigned tail = ring.tail.load(std::memory_order_relaxed);
+    unsigned head = ring.head.load(std::memory_order_acquire);
+
+    if (tail != head && !ring.named) {
+      fprintf(traceFile,
+              "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"name\":\"%s\"}}",
+              firstRecord ? "" : ",\n", (int)getpid(), (int)ring.tid, ring.threadName);
+      firstRecord = false;
+      ring.named = true;
+    }
+    for (; tail != head; tail++) writeRecord(ring, ring.records[tail & (TRACE_RING_SIZE - 1)]);
+    ring.tail.store(tail, std::memory_order_release);
+
+    if (unsigned long dropped = ring.dropped.exchange(0, std::memory_order_relaxed)) {
+      writeRecord(ring, {monotonicNs(), "trace records dropped", "records", (long long)dropped,
+                         0, TRACE_INSTANT});
+    }
+
+    // its owner has exited after the records just written, nothing more can come
+    if (ring.exited.load(std::memory_order_acquire) &&
+        ring.head.load(std::memory_order_acquire) == tail) {
+      ring.named = false;
+      ring.exited.store(false, std::memory_order_relaxed);
+      ring.claimed.store(false, std::memory_order_release);
+    }
+  }
+  fflush(traceFile);
+}
+
+static void writerLoop() {
+  std::unique_lock<std::mutex> lock(writerMutex);
+  while (!writerStop) {
+    writerWake.wait_for(lock, std::chrono::milliseconds(TRACE_FLUSH_MS));
+    drainRings();
+  }
+}
+
+bool startTrace(const std::string &path) {
+  if (traceFile) return false;
+  FILE *file = fopen(path.c_str(), "we");
+  if (!file) return false;
+
+  TraceRing *pool = rings.load(std::memory_order_relaxed);
+  if (!pool) {
+    pool = new TraceRing[TRACE_RINGS];
+    rings.store(pool, std::memory_order_release);
+  }
+  // records left from an earlier trace are stale; the writer isn't running
+  for (int i = 0; i < TRACE_RINGS; i++) {
+    pool[i].tail.store(pool[i].head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    pool[i].dropped.store(0, std::memory_order_relaxed);
+    pool[i].named = false;
+  }
+
+  traceFile = file;
+  tracePath = path;
+  firstRecord = true;
+  writerStop = false;
+  fputs("[\n", traceFile); // the JSON array format, still readable if never closed
+  writer = std::thread(writerLoop);
+  traceEnabled.store(true, std::memory_order_release);
+  return true;
+}
+
+std::string stopTrace() {
+  if (!traceFile) return "";
+  traceEnabled.store(false, std::memory_order_release);
+  {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    writerStop = true;
+  }
+  writerWake.notify_one();
+  writer.join(); // drains once more on the way out
+
+  fputs("\n]\n", traceFile);
+  fclose(traceFile);
+  traceFile = nullptr;
+  return tracePath;
+}
@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Optional tracing of the event-to-audio pipeline (`--trace <file>`, `ctl trace`). Each
+// thread records into its own lock-free ring; a writer thread drains them into a Chrome trace
+// JSON file (open it in ui.perfetto.dev or chrome://tracing). When off, a trace point costs
+// one relaxed load.
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum TracePhase : char {
+  TRACE_BEGIN = 'B',
+  TRACE_END = 'E',
+  TRACE_INSTANT = 'i',
+  TRACE_FLOW_START = 's', // links a key press on the input thread...
+  TRACE_FLOW_END = 'f',   // ...to the voice it starts on the audio thread
+};
+
+extern std::atomic<bool> traceEnabled;
+
+// `name` and `argName` must be string literals, only the pointers are recorded
+void recordTrace(TracePhase phase, const char *name, const char *argName, long long arg,
+                 unsigned long long flowId);
+
+inline void trace(TracePhase phase, const char *name, const char *argName = nullptr,
+                  long long arg = 0, unsigned long long flowId = 0) {
+  if (traceEnabled.load(std::memory_order_relaxed)) {
+    recordTrace(phase, name, argName, arg, flowId);
+  }
+}
+
+// Flow id of a trigger, computed the same way where it is queued and where it starts
+inline unsigned long long traceFlowId(const void *sample, long long eventTimeNs) {
+  return (unsigned long long)(uintptr_t)sample ^ (unsigned long long)eventTimeNs;
+}
+
+// Start writing a trace to `path`; false if it can't be created or a trace is running
+bool startTrace(const std::string &path);
+
+// Flush and close the running trace, returns its path ("" if none was running)
+std::string stopTrace();
+
+#endif // TRACE_H